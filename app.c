@@ -33,13 +33,26 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#ifdef POSIX_MT
+#include <pthread.h>
+#endif
 
 #include <lilgp.h>
 
-#include <cpgplot.h>
-
 #include "lambda.h"
+#include "fitcache.h"
+#include "gpstat.h"
+#include "lz.h"
+#include "workers.h"
+
+/* output streams of the application */
+#define OUT_STA		OUT_USER	/* statistics; see gpstat.h */
+#define OUT_HISZ	(OUT_USER+1)	/* history of best individuals, compressed */
 
 #define NELEMS(a)	(sizeof(a)/(sizeof((a)[0])))
 
@@ -49,11 +62,683 @@
 
 globaldata g;
 
-/* comparison function for qsort */
+/* fitness cases, from app.testcases in ascending order */
+static int deftestcases[] = { 10, 20, 50, 100, 200 };
+static int testcases[MAXCASES];
+
+/* #testcases at each stage of the curriculum */
+static int stages[MAXCASES];
+
+static float *racefit;	/* for computing the race limit; g.maxpop elements */
+
+/*
+ * steps and peak #cells of the last evaluation of each tree, by
+ * treehash(); the statistics of individuals whose fitness was not
+ * evaluated again come from here.  the table is cleared when half full.
+ */
+static struct trec {
+     unsigned long key;	/* 0 = empty */
+     int steps, peak;
+} *trecs;
+static unsigned long trecmask;	/* #entries of trecs - 1 */
+static long ntrecs;
+
+/*
+ * an engine of the lambda library and what the evaluations done on it
+ * find out.  with POSIX_MT, the kernel evaluates the subpopulations
+ * (islands) in threads of their own; a thread takes a free island at
+ * its first evaluation and gives it back when it ends, so that the
+ * engines and their memos live on from one generation to the next.
+ * the main thread always has island0.  the Church numerals for the
+ * samples and the correct answers are built once in each engine and
+ * shared by its evaluations; they must never be reduced or freed in
+ * between.  the rest is merged in app_end_of_evaluation().
+ */
+struct island {
+     Lstate engine;		/* NULL = that of the main thread */
+     Lexp samples[MAXCASES];	/* testcases[i] */
+     Lexp targets[MAXCASES];	/* testcases[i]*TARGETFACTOR; try to find *2 function */
+
+     /* steps and peak #cells of the reductions that reached normal form */
+     int *finsteps;
+     int *finpeaks;
+     int nfinished;
+     int maxfinished;	/* #elements of finsteps and finpeaks */
+
+     /* trees evaluated, for trecstore() */
+     struct trec *done;
+     int ndone, maxdone;
+
+     int busy;		/* taken by a thread */
+     struct island *next;
+};
+
+static struct island island0;
+static struct island *islands = &island0;	/* all of them */
+
+#ifdef POSIX_MT
+static __thread struct island *here;	/* of the calling thread */
+static pthread_mutex_t islandlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t islandkey;		/* to give the island back */
+#else
+static struct island *here = &island0;
+#endif
+
+/* what evaluating an individual found out; see evaluate() */
+struct outcome {
+     double r_fitness;	/* sum of the distances */
+     int nfin;		/* #reductions that ended within maxstep */
+     int bounded;	/* lost the race; r_fitness is a lower bound */
+     int totalsteps, maxpeak;
+     int nnormal;	/* #reductions that reached normal form */
+     int steps[MAXCASES], peak[MAXCASES];	/* of each of them */
+};
+
+/*
+ * with app.workers, the individuals bred are evaluated by worker
+ * processes (see workers.c) in app_end_of_breeding(); generation 0 is
+ * evaluated here.  a job is the tree in de Bruijn form, and a batch
+ * has what may change from one generation to the next.
+ */
+struct batch {
+     int maxstep, maxcells;
+     double racelimit;
+     int ncur;
+     int cases[MAXCASES];
+};
+
+struct wtree {
+     int n;		/* #nodes */
+     int size;		/* room for; Var idx[size] and int types[size] follow */
+};
+
+static struct farmjob {
+     individual *ind;
+     unsigned long key;	/* for the fitness cache */
+} *farmjobs;
+static int maxfarmjobs;
+
+/* evaluated by the workers but bounded; app_eval_fitness() leaves them */
+static individual **farmed;
+static int nfarmed;
+
+/* columns of a block of the statistics stream */
+static int *gsncells, *gssteps, *gspeak;
+static float *gsfitness;
+static unsigned char *gsstatus;
+static int gsstarted = 0;
+
+/*
+ * the statistics and, if compressed, the history of best individuals
+ * are written through these; a frame goes out at each checkpoint
+ */
+static struct zstream stastream, hisstream;
+
+/*
+ * binary section of the checkpoint, after the line
+ *	lambda-gp checkpoint <version> <#bytes>
+ * a struct ckstate, the printed best-of-run individual, the tree
+ * records and (if app.checkpoint_memo) the memo of normal forms.
+ * it is written at once and read back through mmap.
+ */
+#define CK_VERSION	2
+
+struct ckstate {
+     int size;		/* sizeof(struct ckstate), as a check */
+     int gen;
+     int stage;
+     int ncur;
+     int cases[MAXCASES];
+     double racelimit;
+     int maxstep, maxcells;
+     int cachestale;
+     int bestnfvalid;
+     int bestscored;
+     int gsstarted;
+     long ntrecs;	/* #struct trec that follow bestnf */
+     long memolen;	/* #bytes of the memo that follow them */
+};
+
+static int checkpointmemo = 1;	/* app.checkpoint_memo */
+static int initialized = 0;	/* app_initialize() done */
+static void *ckmap;		/* mapped checkpoint file, to be restored */
+static size_t ckmaplen;
+static unsigned char *ckdata;	/* the binary section in it */
+static long cklen;
+
+/*
+ * normal form of the best-of-run individual, as printed to OUT_HIS.
+ * the reduction is redone only when there is a new best-of-run.
+ */
+static char bestnf[4096];
+static int bestnfvalid = 0;
+
+/*
+ * what the fitness of the best-of-run was scored on.  one scored on
+ * fewer testcases, at an earlier stage of the curriculum or in a
+ * subsample, keeps that fitness and may stay the best-of-run for good;
+ * its 0 means nothing until fullfitness() confirms it.
+ */
+enum {
+     BEST_SUBSET = 0,	/* fewer testcases, not checked on all */
+     BEST_FULL,		/* all the testcases */
+     BEST_IMPERFECT,	/* fewer testcases, and not perfect on all */
+};
+static int bestscored = BEST_SUBSET;
+
+/* comparison functions for qsort */
 int orderofsize(struct iinfo *x, struct iinfo *y) {
      return x->ncells - y->ncells;
 }
 
+int orderofint(const void *x, const void *y) {
+     return *(const int *)x - *(const int *)y;
+}
+
+int orderoffloat(const void *x, const void *y) {
+     float a = *(const float *)x, b = *(const float *)y;
+
+     return (a > b) - (a < b);
+}
+
+int orderofptr(const void *x, const void *y) {
+     individual *a = *(individual * const *)x, *b = *(individual * const *)y;
+
+     return (a > b) - (a < b);
+}
+
+/*
+ * getints - read up to max integers separated by spaces or commas from
+ *           parameter name.  returns how many, 0 if not set, -1 if malformed.
+ */
+static int getints(char *name, int a[], int max)
+{
+     char *param, *end;
+     int n;
+
+     if ((param = get_parameter(name)) == NULL)
+	  return 0;
+     for (n = 0; ; n++) {
+	  while (*param == ' ' || *param == '\t' || *param == ',')
+	       param++;
+	  if (*param == '\0')
+	       return n;
+	  if (n >= max)
+	       return -1;
+	  a[n] = strtol(param, &end, 10);
+	  if (end == param)
+	       return -1;
+	  param = end;
+     }
+}
+
+/*
+ * schedule - choose the testcases for the next generation: all those of
+ *            the current stage, or app.subsample of them at random.
+ *            returns 1 if they differ from the last ones.
+ */
+static int schedule(void)
+{
+     int i, j, t, n;
+     int old[MAXCASES], nold;
+
+     nold = g.ncur;
+     for (i = 0; i < nold; i++)
+	  old[i] = g.cases[i];
+
+     n = stages[g.stage];
+     for (i = 0; i < n; i++)
+	  g.cases[i] = i;
+     if (g.subsample > 0 && g.subsample < n) {
+	  /* first g.subsample of a random permutation */
+	  for (i = 0; i < g.subsample; i++) {
+	       j = i + random_int(n - i);
+	       t = g.cases[i];
+	       g.cases[i] = g.cases[j];
+	       g.cases[j] = t;
+	  }
+	  n = g.subsample;
+	  /* cheapest first, for racing */
+	  qsort(g.cases, n, sizeof(g.cases[0]), orderofint);
+     }
+     g.ncur = n;
+
+     if (n != nold)
+	  return 1;
+     for (i = 0; i < n; i++)
+	  if (g.cases[i] != old[i])
+	       return 1;
+     return 0;
+}
+
+/*
+ * translate - convert the GP tree of ind to a lambda-lib expression
+ */
+static Lexp translate(individual *ind)
+{
+     return Itree2lexp(ind->tr[0].data, ind->tr[0].size);
+}
+
+/*
+ * evalcase - distance between indiv0 applied to testcase c and the
+ *            answer.  if limit >= 0, the distance is only known to be
+ *            > limit when it is.  *steps and *peak tell the cost of the
+ *            reduction and *normal whether it reached normal form.
+ */
+static int evalcase(Lexp indiv0, int c, int limit, int *steps, int *peak, int *normal)
+{
+     int maxstep = g.maxstep;	/* max #step of beta reduction */
+     int maxcells = g.maxcells;	/* max #cells during beta reductions */
+     Lexp indiv, sample, applied;
+     Lexp refs[2];
+     int limits[2], dists[2];
+     int dist;
+
+     indiv = Lcopy(indiv0);		/* to preserve original */
+
+     if (tracing()) {
+	  printf("indiv: ");
+	  Lfprint(stdout, indiv);
+     }
+
+     sample = Lcopy(here->samples[c]);		/* consumed by the reduction */
+
+     applied = Lappl(indiv, sample);
+
+     if (tracing()) {
+	  printf("applied: ");
+	  Lfprint(stdout, applied);
+     }
+
+     if (g.lazy) {
+	  /* reduce only as far as the comparisons need */
+	  *steps = 0;
+	  if (Lbetadiff(applied, here->samples[c], steps, maxstep, maxcells, 0) == 0) {
+	       dist = IPENALTY;		/* got identity function */
+	       *peak = Lpeakcells();
+	  } else {
+	       *peak = Lpeakcells();
+	       dist = Lbetadiff(applied, here->targets[c], steps, maxstep, maxcells, limit);
+	       if (Lpeakcells() > *peak)
+		    *peak = Lpeakcells();
+	  }
+     } else {
+	  *steps = Lbeta(applied, CANONICAL, maxstep, maxcells);
+	  *peak = Lpeakcells();
+
+	  /* beta reduction may not finish within maxstep, */
+	  /* but let us regard the result as the answer */
+
+	  /* one walk for both; only whether it differs from the sample matters */
+	  refs[0] = here->samples[c];		/* avoid identity function */
+	  limits[0] = 0;
+	  refs[1] = here->targets[c];
+	  limits[1] = limit;
+	  Ldiffn(applied, refs, 2, limits, dists);
+	  if (dists[0] == 0)		/* got identity function */
+	       dist = IPENALTY;
+	  else
+	       dist = dists[1];
+     }
+
+     if (tracing()) {
+	  printf("applied rewritten to: ");
+	  Lfprint(stdout, applied);
+     }
+
+     /* applied overwritten with the result */
+
+     *normal = *steps < maxstep && Lcountcells(applied) <= maxcells &&
+	  (limit < 0 || dist <= limit);
+
+     Lfree(applied);
+     return dist;
+}
+
+/*
+ * fullfitness - sum of the distances of ind on all the testcases.  only
+ *               known to be > 0 when it is, which is enough to confirm
+ *               a perfect individual.
+ */
+static int fullfitness(individual *ind)
+{
+     Lexp indiv0;
+     int i, steps, peak, normal;
+     int sum;
+
+     indiv0 = translate(ind);
+     sum = 0;
+     for (i = 0; i < g.ncases && sum == 0; i++)
+	  sum += evalcase(indiv0, i, 0, &steps, &peak, &normal);
+     Lfree(indiv0);
+     return sum;
+}
+
+/*
+ * fingerprint - of the problem as it is evaluated now, to tell the
+ *               results in the fitness cache apart
+ */
+static unsigned long fingerprint(void)
+{
+     unsigned long h;
+     int k;
+
+     h = Fmix(0, TARGETFACTOR);
+     h = Fmix(h, IPENALTY);
+     h = Fmix(h, g.maxstep);
+     h = Fmix(h, g.maxcells);
+     h = Fmix(h, g.ncur);
+     for (k = 0; k < g.ncur; k++)
+	  h = Fmix(h, testcases[g.cases[k]]);
+     return h;
+}
+
+/*
+ * treehash - hash of the prefix array of a GP tree; equal trees have
+ *            equal hashes.  never 0.
+ */
+static unsigned long treehash(lnode *data, int size)
+{
+     unsigned long h;
+     int i;
+
+     h = 0;
+     for (i = 0; i < size; ) {
+	  h = Fmix(h, (unsigned long)data[i].f->type);
+	  switch (data[i].f->type) {
+	  case TERM_ERC:
+	       h = Fmix(h, (unsigned long)data[i+1].d->d);
+	       i += 2;
+	       break;
+	  case FUNC_EXPR:
+	       i += 2;	/* skip node */
+	       break;
+	  default:
+	       i += 1;
+	       break;
+	  }
+     }
+     return h ? h : 1;
+}
+
+static struct trec *trecslot(unsigned long key)
+{
+     unsigned long i;
+
+     for (i = key & trecmask; ; i = (i + 1) & trecmask)
+	  if (trecs[i].key == 0 || trecs[i].key == key)
+	       return &trecs[i];
+}
+
+static void trecstore(unsigned long key, int steps, int peak)
+{
+     struct trec *t;
+
+     if (2 * (ntrecs + 1) > (long)trecmask + 1) {
+	  memset(trecs, 0, (trecmask + 1) * sizeof(trecs[0]));
+	  ntrecs = 0;
+     }
+     t = trecslot(key);
+     if (t->key == 0)
+	  ntrecs++;
+     t->key = key;
+     t->steps = steps;
+     t->peak = peak;
+}
+
+/*
+ * build - make the Church numerals of the testcases for island is, in
+ *         the engine of the calling thread
+ */
+static void build(struct island *is)
+{
+     int i;
+
+     for (i = 0; i < g.ncases; i++) {
+	  is->samples[i] = Cchurch_num(testcases[i]);
+	  is->targets[i] = Cchurch_num(testcases[i]*TARGETFACTOR);
+     }
+}
+
+#ifdef POSIX_MT
+/*
+ * giveback - let another thread take the island of a thread that ends
+ */
+static void giveback(void *p)
+{
+     struct island *is = (struct island *)p;
+
+     pthread_mutex_lock(&islandlock);
+     is->busy = 0;
+     pthread_mutex_unlock(&islandlock);
+}
+
+/*
+ * takeisland - give the calling thread a free island, made if none
+ */
+static void takeisland(void)
+{
+     struct island *is;
+     int made = 0;
+
+     pthread_mutex_lock(&islandlock);
+     for (is = islands; is != NULL && is->busy; is = is->next)
+	  ;
+     if (is == NULL) {
+	  if ((is = (struct island *)calloc(1, sizeof(*is))) == NULL) {
+	       fprintf(stderr, "cannot allocate an island\n");
+	       exit(1);
+	  }
+	  is->engine = Lnewstate();
+	  is->next = island0.next;
+	  island0.next = is;
+	  made = 1;
+     }
+     is->busy = 1;
+     pthread_mutex_unlock(&islandlock);
+
+     Luse(is->engine);
+     if (made) {
+	  Linit();
+	  Lmemo(g.memo);
+	  build(is);
+     }
+     pthread_setspecific(islandkey, is);
+     here = is;
+}
+#endif
+
+/*
+ * finished - record a reduction that reached normal form on island is,
+ *            for the budgets
+ */
+static void finished(struct island *is, int steps, int peak)
+{
+     if (is->nfinished >= is->maxfinished) {
+	  is->maxfinished = (is->maxfinished > 0) ? is->maxfinished * 2 : 1024;
+	  is->finsteps = (int *)REALLOC(is->finsteps, is->maxfinished * sizeof(int));
+	  is->finpeaks = (int *)REALLOC(is->finpeaks, is->maxfinished * sizeof(int));
+	  if (is->finsteps == NULL || is->finpeaks == NULL) {
+	       fprintf(stderr, "cannot allocate data for %d reductions\n", is->maxfinished);
+	       exit(1);
+	  }
+     }
+     is->finsteps[is->nfinished] = steps;
+     is->finpeaks[is->nfinished] = peak;
+     is->nfinished++;
+}
+
+/*
+ * evaluated - record the cost of evaluating the tree of key on island
+ *             is, for trecstore()
+ */
+static void evaluated(struct island *is, unsigned long key, int steps, int peak)
+{
+     if (is->ndone >= is->maxdone) {
+	  is->maxdone = (is->maxdone > 0) ? is->maxdone * 2 : 1024;
+	  is->done = (struct trec *)REALLOC(is->done, is->maxdone * sizeof(is->done[0]));
+	  if (is->done == NULL) {
+	       fprintf(stderr, "cannot allocate data for %d trees\n", is->maxdone);
+	       exit(1);
+	  }
+     }
+     is->done[is->ndone].key = key;
+     is->done[is->ndone].steps = steps;
+     is->done[is->ndone].peak = peak;
+     is->ndone++;
+}
+
+/*
+ * merge - take in what the evaluations on the islands found out; the
+ *         reductions for the budgets are gathered in island0
+ */
+static void merge(void)
+{
+     struct island *is;
+     int i;
+
+     for (is = islands; is != NULL; is = is->next) {
+	  for (i = 0; i < is->ndone; i++)
+	       trecstore(is->done[i].key, is->done[i].steps, is->done[i].peak);
+	  is->ndone = 0;
+	  if (is == &island0)
+	       continue;
+	  for (i = 0; i < is->nfinished; i++)
+	       finished(&island0, is->finsteps[i], is->finpeaks[i]);
+	  is->nfinished = 0;
+     }
+}
+
+/*
+ * reserve - make room for n individuals in g.idata[], racefit[],
+ *           the columns of the statistics and the tree records
+ */
+static void reserve(int n)
+{
+     unsigned long m;
+
+     if (n <= g.maxpop)
+	  return;
+     g.idata = (struct iinfo *)REALLOC(g.idata, n * sizeof(g.idata[0]));
+     racefit = (float *)REALLOC(racefit, n * sizeof(racefit[0]));
+     gsncells = (int *)REALLOC(gsncells, n * sizeof(int));
+     gsfitness = (float *)REALLOC(gsfitness, n * sizeof(float));
+     gsstatus = (unsigned char *)REALLOC(gsstatus, n * sizeof(unsigned char));
+     gssteps = (int *)REALLOC(gssteps, n * sizeof(int));
+     gspeak = (int *)REALLOC(gspeak, n * sizeof(int));
+
+     /* the records of the trees are dropped */
+     for (m = 1; m < 4 * (unsigned long)n; m <<= 1)
+	  ;
+     FREE(trecs);
+     trecs = (struct trec *)calloc(m, sizeof(trecs[0]));
+     trecmask = m - 1;
+     ntrecs = 0;
+
+     if (g.idata == NULL || racefit == NULL || trecs == NULL ||
+	 gsncells == NULL || gsfitness == NULL || gsstatus == NULL ||
+	 gssteps == NULL || gspeak == NULL) {
+	  fprintf(stderr, "cannot allocate data for %d individuals\n", n);
+	  exit(1);
+     }
+     g.maxpop = n;
+}
+
+/*
+ * collect - fill g.idata[] from the individuals of the population,
+ *           evaluated in this generation or taken from the cache
+ */
+static void collect(multipop *mpop)
+{
+     int i, p, n;
+     individual *ind;
+     struct trec *t;
+
+     n = 0;
+     for (p = 0; p < mpop->size; p++)
+	  n += mpop->pop[p]->size;
+     reserve(n);
+
+     g.npop = 0;
+     for (p = 0; p < mpop->size; p++)
+	  for (i = 0; i < mpop->pop[p]->size; i++) {
+	       ind = &mpop->pop[p]->ind[i];
+	       g.idata[g.npop].ncells = ind->tr[0].nodes;
+	       /* sum of the distances */
+	       g.idata[g.npop].fitness = floor(ind->r_fitness * g.ncur + 0.5);
+	       g.idata[g.npop].bounded = (ind->evald != EVAL_CACHE_VALID);
+	       g.idata[g.npop].reduction_finished =
+		    !g.idata[g.npop].bounded && ind->hits == g.ncur;
+	       t = trecslot(treehash(ind->tr[0].data, ind->tr[0].size));
+	       g.idata[g.npop].steps = t->key ? t->steps : -1;
+	       g.idata[g.npop].peak = t->key ? t->peak : -1;
+	       g.npop++;
+	  }
+}
+
+/*
+ * writestats - append the block of this generation to the statistics
+ *              stream; g.idata[] must be in order of size
+ */
+static void writestats(void)
+{
+     FILE *fp;
+     struct gshead h;
+     struct gsblock b;
+     int i, n;
+
+     if (stastream.fp == NULL) {
+	  if ((fp = output_filehandle(OUT_STA)) == NULL)
+	       return;
+	  Zopenwrite(&stastream, fp, g.compress);
+     }
+     if (!gsstarted) {
+	  memset(&h, 0, sizeof(h));
+	  memcpy(h.magic, GS_MAGIC, sizeof(h.magic));
+	  h.version = GS_VERSION;
+	  h.order = GS_ORDER;
+	  Zwrite(&stastream, &h, sizeof(h));
+	  gsstarted = 1;
+     }
+
+     n = g.npop;
+     for (i = 0; i < n; i++) {
+	  gsncells[i] = g.idata[i].ncells;
+	  gsfitness[i] = g.idata[i].fitness;
+	  gsstatus[i] = g.idata[i].bounded ? GS_BOUNDED :
+	       g.idata[i].reduction_finished ? GS_FINISHED : GS_UNFINISHED;
+	  gssteps[i] = g.idata[i].steps;
+	  gspeak[i] = g.idata[i].peak;
+     }
+     b.magic = GS_BLOCKMAGIC;
+     b.gen = g.gen;
+     b.n = n;
+     b.ncases = g.ncur;
+     Zwrite(&stastream, &b, sizeof(b));
+     Zwrite(&stastream, gsncells, n * sizeof(int));
+     Zwrite(&stastream, gsfitness, n * sizeof(float));
+     Zwrite(&stastream, gsstatus, n * sizeof(unsigned char));
+     Zwrite(&stastream, gssteps, n * sizeof(int));
+     Zwrite(&stastream, gspeak, n * sizeof(int));
+}
+
+/*
+ * budget - app.budget_quantile of the n values in a, times
+ *          app.budget_factor, but not over ceil.  sorts a.
+ */
+static int budget(int a[], int n, int ceil)
+{
+     double b;
+
+     qsort(a, n, sizeof(a[0]), orderofint);
+     b = a[(int)(g.budgetquantile * (n - 1))] * g.budgetfactor;
+     if (b > ceil)
+	  return ceil;
+     if (b < 1.0)
+	  return 1;
+     return (int)b;
+}
+
 /* app_build_function_sets()
  *
  * this function should build data structures describing the function
@@ -102,144 +787,292 @@ int app_build_function_sets ( void )
      return ret;
 }
 
-/* app_eval_fitness()
- *
- * this function should evaluate the fitness of the individual.  typically
- * this function will loop over all the fitness cases.  the following
- * fields in the (individual *) should be filled in:
- *    r_fitness    (raw fitness)
- *    s_fitness    (standardized fitness)
- *    a_fitness    (adjusted fitness)
- *    hits         (hits)
- *    evald        (always set to EVAL_CACHE_VALID)
+/*
+ * evaluate - loop over the fitness cases of this generation
  */
-
-void app_eval_fitness ( individual *ind )
+static void evaluate(Lexp indiv0, struct outcome *o)
 {
-     int testcases[] = { 10, 20, 50, 100, 200 };
-     int maxstep = 5000;	/* max #step of beta reduction; XXX: should be defined as constant */
-     int maxcells = 5000;	/* max #cells during beta reductions; ditto */
-     int i;
-     DATATYPE indiv0;
-     char s[65536];
-     Lexp indiv, sample, correct, applied, sample0;
-     int steps, beta_finished;
-     int ncells;
-     int dist, dist0;
-
-     set_current_individual ( ind );
-     
-     ind->r_fitness = 0.0;
-     ind->hits = 0;
+     int i, k;
+     int steps, peak, normal;
+     int dist;
+     int limit;
 
-     /*
-      * convert GP internal expression to lambda-lib expression
-      */
-     g.blevel = 0;
+     memset(o, 0, sizeof(*o));
+     for ( k = 0 ; k < g.ncur ; k++ )
+     {
+	  i = g.cases[k];
 
-     if (g.debug) {
-	  printf("tree: ");
-	  print_tree(ind->tr[0].data, stdout);
-     }
+	  if (g.racelimit >= 0.0)
+	       limit = g.racelimit - o->r_fitness;
+	  else
+	       limit = -1;
 
-     indiv0 = evaluate_tree ( ind->tr[0].data, 0 );
-     if (indiv0 < 0) {
-	  /* singleton tree */
-	  indiv0 = Icreatebvar(indiv0);
+	  dist = evalcase(indiv0, i, limit, &steps, &peak, &normal);
+	  o->totalsteps += steps;
+	  if (peak > o->maxpeak)
+	       o->maxpeak = peak;
+
+	  if (steps == g.maxstep) {
+	       if (tracing())
+		    printf("maxstep reached\n");
+	  } else
+	       o->nfin++;
+	  if (normal) {
+	       /* data for the next budgets */
+	       o->steps[o->nnormal] = steps;
+	       o->peak[o->nnormal] = peak;
+	       o->nnormal++;
+	  }
+	  if (tracing())
+	       printf("case %d, r_fitness += %d\n", i, dist);
+
+	  o->r_fitness += (double)dist;
+
+	  /* testcases are in order of cost; give up once it cannot win */
+	  if (g.racelimit >= 0.0 && o->r_fitness > g.racelimit) {
+	       o->bounded = 1;
+	       if (tracing())
+		    printf("race lost at case %d\n", i);
+	       break;
+	  }
+
+          /* here you would score the value returned by the individual
+           * and update the raw fitness and/or hits. */
+        
      }
+}
 
-     ncells = Lcountcells(indiv0);
-     g.idata[g.npop].ncells = ncells;
+/*
+ * settle - give ind the fitness in o, and take in the rest.  the
+ *          results are stored for reuse if store.
+ */
+static void settle(individual *ind, unsigned long key, struct outcome *o, int store)
+{
+     int i;
 
-     LLexp2str(indiv0, s, sizeof(s));
-     if (g.debug)
-	  printf("indiv0: %s\n", s);
+     for (i = 0; i < o->nnormal; i++)
+	  finished(here, o->steps[i], o->peak[i]);
+     if (store) {
+	  if (g.fitcache && !o->bounded)
+	       Fstore(key, g.problem, o->r_fitness, o->nfin);
+	  evaluated(here, treehash(ind->tr[0].data, ind->tr[0].size), o->totalsteps, o->maxpeak);
+     }
 
      /*
-      * loop over all the fitness cases.
+      * compute the standardized and raw fitness.
+      * if bounded, the cases left out would only add to r_fitness
       */
-     beta_finished = 1;
-     for ( i = 0 ; i < NELEMS(testcases) ; i++ )
-     {
-	  indiv = Lcopy(indiv0);		/* to preserve original */
 
-	  LLexp2str(indiv, s, sizeof(s));
-	  if (g.debug)
-	       printf("indiv: %s\n", s);
-
-	  sample = Cchurch_num(testcases[i]);
-	  sample0 = Lcopy(sample);			/* sample for avoiding identity function */
-	  correct = Cchurch_num(testcases[i]*2);	/* try to find *2 function */
+     ind->r_fitness = o->r_fitness / g.ncur;
+     ind->s_fitness = ind->r_fitness;
+     ind->a_fitness = 1/(1+ind->s_fitness);
 
-	  applied = Lappl(indiv, sample);
+     if (tracing())
+       printf("raw %lf, std %lf, adj %lf\n", ind->r_fitness, ind->s_fitness, ind->a_fitness);
 
-	  LLexp2str(applied, s, sizeof(s));
-	  if (g.debug)
-	       printf("applied: %s\n", s);
+     /*
+      * the statistics for g.idata[] are taken from the population in
+      * app_end_of_evaluation(), so the cache can be used; hits tells
+      * how many reductions finished within maxstep.  a bounded
+      * fitness is not final and must be evaluated again.
+      */
+     ind->hits = o->nfin;
 
-	  steps = Lbeta(applied, CANONICAL, maxstep, maxcells);
+     /* always leave this line in. */
+     ind->evald = o->bounded ? EVAL_CACHE_INVALID : EVAL_CACHE_VALID;
+}
 
-	  /* beta reduction may not finish within maxstep, */
-	  /* but let us regard the result as the answer */
+/*
+ * cost - estimated #steps to evaluate ind: those of its last evaluation
+ *        if recorded (e.g., reproduced), or else its size at the median
+ *        steps per node of the last generation
+ */
+static double cost(individual *ind)
+{
+     struct trec *t;
 
-	  LLexp2str(applied, s, sizeof(s));
-	  if (g.debug)
-	       printf("applied rewritten to: %s\n", s);
+     t = trecslot(treehash(ind->tr[0].data, ind->tr[0].size));
+     if (t->key != 0)
+	  return t->steps + ind->tr[0].nodes;
+     return ind->tr[0].nodes * (g.stepspernode + 1.0);
+}
 
-	  /* applied overwritten with the result */
+/*
+ * work - evaluate a tree in a worker process
+ */
+static void work(const void *params, const void *in, int len, void *out)
+{
+     const struct batch *b = (const struct batch *)params;
+     const struct wtree *t = (const struct wtree *)in;
+     const Var *idx = (const Var *)(t + 1);
+     Lexp indiv0;
+
+     g.maxstep = b->maxstep;
+     g.maxcells = b->maxcells;
+     g.racelimit = b->racelimit;
+     g.ncur = b->ncur;
+     memcpy(g.cases, b->cases, sizeof(g.cases));
+
+     indiv0 = Lfromdebruijn(t->n, (int *)(idx + t->size), (Var *)idx);
+     evaluate(indiv0, (struct outcome *)out);
+     Lfree(indiv0);
+}
 
-	  if (steps == maxstep) {
-	       beta_finished = 0;
-	       if (g.debug)
-		    printf("maxstep reached\n");
+/*
+ * farm - evaluate the individuals bred by the workers.  those the
+ *        workers could not take are left to app_eval_fitness(); those
+ *        whose worker crashed get the worst fitness.
+ */
+static void farm(multipop *mpop)
+{
+     struct batch *b;
+     struct wtree *t;
+     struct outcome o, *out;
+     individual *ind;
+     Lexp indiv0;
+     unsigned long key;
+     int i, j, p, n, njobs, ncrashed;
+
+     nfarmed = 0;
+     if ((b = (struct batch *)Wbegin()) == NULL)
+	  return;
+     b->maxstep = g.maxstep;
+     b->maxcells = g.maxcells;
+     b->racelimit = g.racelimit;
+     b->ncur = g.ncur;
+     memcpy(b->cases, g.cases, sizeof(b->cases));
+
+     n = 0;
+     for (p = 0; p < mpop->size; p++)
+	  n += mpop->pop[p]->size;
+     if (n > maxfarmjobs) {
+	  farmjobs = (struct farmjob *)REALLOC(farmjobs, n * sizeof(farmjobs[0]));
+	  farmed = (individual **)REALLOC(farmed, n * sizeof(farmed[0]));
+	  if (farmjobs == NULL || farmed == NULL) {
+	       fprintf(stderr, "cannot allocate data for %d individuals\n", n);
+	       exit(1);
 	  }
-	  dist0 = Ldiff(applied, sample0);
-	  if (dist0 == 0)			/* got identity function */
-	       dist = IPENALTY;
-	  else
-	       dist = Ldiff(applied, correct);
-	  if (g.debug)
-	       printf("case %d, r_fitness += %d\n", i, dist);
-
-	  ind->r_fitness += (double)dist;
+	  maxfarmjobs = n;
+     }
 
-	  Lfree(applied);
-	  Lfree(correct);
-	  Lfree(sample0);
+     /* the jobs; results in the fitness cache are taken here */
+     njobs = 0;
+     for (p = 0; p < mpop->size; p++)
+	  for (i = 0; i < mpop->pop[p]->size; i++) {
+	       ind = &mpop->pop[p]->ind[i];
+	       if (ind->evald == EVAL_CACHE_VALID)
+		    continue;
+	       key = 0;
+	       if (g.fitcache) {
+		    indiv0 = translate(ind);
+		    key = Lhash(indiv0);
+		    Lfree(indiv0);
+		    memset(&o, 0, sizeof(o));
+		    if (Flookup(key, g.problem, &o.r_fitness, &o.nfin)) {
+			 settle(ind, key, &o, 0);
+			 continue;
+		    }
+	       }
+	       n = ind->tr[0].size;
+	       if ((j = Wadd(sizeof(*t) + n * (sizeof(Var) + sizeof(int)), cost(ind), (void **)&t)) < 0)
+		    continue;
+	       t->size = n;
+	       t->n = Itree2debruijn(ind->tr[0].data, n, (int *)((Var *)(t + 1) + n), (Var *)(t + 1));
+	       farmjobs[j].ind = ind;
+	       farmjobs[j].key = key;
+	       njobs = j + 1;
+	  }
 
-          /* here you would score the value returned by the individual
-           * and update the raw fitness and/or hits. */
-        
+     Wrun();
+
+     /* in the order of the population, as if evaluated here */
+     ncrashed = 0;
+     for (j = 0; j < njobs; j++) {
+	  ind = farmjobs[j].ind;
+	  switch (Wresult(j, (void **)&out)) {
+	  case W_DONE:
+	       settle(ind, farmjobs[j].key, out, 1);
+	       break;
+	  case W_CRASHED:
+	       memset(&o, 0, sizeof(o));
+	       o.r_fitness = (double)IPENALTY * g.ncur;
+	       settle(ind, farmjobs[j].key, &o, 0);
+	       ncrashed++;
+	       break;
+	  default:
+	       continue;
+	  }
+	  if (ind->evald != EVAL_CACHE_VALID)
+	       farmed[nfarmed++] = ind;
      }
-     g.idata[g.npop].reduction_finished = beta_finished;
+     qsort(farmed, nfarmed, sizeof(farmed[0]), orderofptr);
+     if (ncrashed > 0)
+	  oprintf(OUT_SYS, 10, "workers: %d individuals crashed and were given the worst fitness\n",
+		  ncrashed);
+}
 
-     Lfree(indiv0);
+/* app_eval_fitness()
+ *
+ * this function should evaluate the fitness of the individual.  typically
+ * this function will loop over all the fitness cases.  the following
+ * fields in the (individual *) should be filled in:
+ *    r_fitness    (raw fitness)
+ *    s_fitness    (standardized fitness)
+ *    a_fitness    (adjusted fitness)
+ *    hits         (hits)
+ *    evald        (always set to EVAL_CACHE_VALID)
+ */
 
-     g.idata[g.npop].fitness = ind->r_fitness;
+void app_eval_fitness ( individual *ind )
+{
+     Lexp indiv0;
+     struct outcome o;
+     unsigned long key = 0;
+     int cached;
+
+#ifdef POSIX_MT
+     /* evaluated in a thread of the kernel for the first time */
+     if (here == NULL)
+	  takeisland();
+#endif
+
+     /* done by a worker */
+     if (nfarmed > 0 &&
+	 bsearch(&ind, farmed, nfarmed, sizeof(farmed[0]), orderofptr) != NULL)
+	  return;
+
+     if (tracing()) {
+	  printf("tree: ");
+	  print_tree(ind->tr[0].data, stdout);
+     }
 
-     /* compute the standardized and raw fitness. */
+     /*
+      * convert GP internal expression to lambda-lib expression
+      */
+     indiv0 = translate(ind);
 
-     ind->r_fitness /= NELEMS(testcases);
-     ind->s_fitness = ind->r_fitness;
-     ind->a_fitness = 1/(1+ind->s_fitness);
+     if (tracing()) {
+	  printf("indiv0: ");
+	  Lfprint(stdout, indiv0);
+     }
 
-     if (g.debug)
-       printf("raw %lf, std %lf, adj %lf\n", ind->r_fitness, ind->s_fitness, ind->a_fitness);
+     /* evaluated in this or another run? */
+     memset(&o, 0, sizeof(o));
+     cached = 0;
+     if (g.fitcache) {
+	  key = Lhash(indiv0);
+	  cached = Flookup(key, g.problem, &o.r_fitness, &o.nfin);
+	  if (cached && tracing())
+	       printf("found in the fitness cache\n");
+     }
 
-     /* always leave this line in. */
-     /* 
-      * XXX: tominaga
-      *
-      * This was EVAL_CACHE__VALID, but it omits
-      * duplicate evaluation for same individuals.
-      * We need to collect array g.napp[]
-      * so turned of the cache.
-      */
-     ind->evald = EVAL_CACHE_INVALID;
+     if (!cached)
+	  evaluate(indiv0, &o);
+     Lfree(indiv0);
 
-     g.npop++;
+     settle(ind, key, &o, !cached);
 
-     if (g.debug)
+     if (tracing())
 	  Lepoolinfo();
 }
 
@@ -278,46 +1111,53 @@ void app_eval_fitness ( individual *ind )
 int app_end_of_evaluation ( int gen, multipop *mpop, int newbest,
                            popstats *gen_stats, popstats *run_stats )
 {
-     int i, sizerank, fitnessrank, colorindex;
-     individual temp;
+     int i, n;
+     individual temp, *best, *shown;
      DATATYPE indiv;
-     char buf[4096];
-     int maxstep, maxcell, steps;
+     int steps;
      int bestrawfit;
+     int oldmaxstep, oldmaxcells;
+
+     nfarmed = 0;
+     merge();
+     collect(mpop);
 
      /*
-      * visualize
+      * statistics, in order of size; rendered offline by gpplot
       */
-
-     /* sort */
      qsort(g.idata, g.npop, sizeof(g.idata[0]), orderofsize);
+     writestats();
+     putchar('\n');
 
-     oprintf(OUT_SYS, 50, "npop=%d\n", g.npop);
-     for (i = 0; i < g.npop; i++) {
-	  oprintf(OUT_SYS, 50, "[%d]%c ncells=%d, fitness=%f. ",
-	    i, (g.idata[i].reduction_finished?' ':'!'), g.idata[i].ncells, g.idata[i].fitness);
-
-	  /* 1 <= sizerank <= 9 */
-	  sizerank = log10((double)g.idata[i].ncells+10.0) / g.ncelldenom * 9 + 1;
-	  if (sizerank > 9)
-	       sizerank = 9;
-
-	  /* 0 <= fitnessrank <= 9; the larger the fitter */
-	  fitnessrank = 9 - (int)(log10((double)g.idata[i].fitness+10.0) / g.distdenom * 10.0);
-	  if (fitnessrank < 0)
-	       fitnessrank = 0;
-
-	  if (g.idata[i].reduction_finished) {
-	       colorindex = sizerank * 10 + fitnessrank;
-	  } else {
-	       colorindex = 0;
+     /* for the estimates of cost(); racefit[] is free until below */
+     if (g.nworkers > 0) {
+	  for (n = i = 0; i < g.npop; i++)
+	       if (g.idata[i].steps >= 0 && g.idata[i].ncells > 0)
+		    racefit[n++] = (float)g.idata[i].steps / g.idata[i].ncells;
+	  if (n > 0) {
+	       qsort(racefit, n, sizeof(racefit[0]), orderoffloat);
+	       g.stepspernode = racefit[n / 2];
 	  }
-	  oprintf(OUT_SYS, 50, "color %d\n", colorindex);
+     }
 
-	  cpgsci(colorindex);
-	  cpgrect((float)g.gen, (float)(g.gen+1), (float)i, (float)(i+1));
+     /* raw fitness worse than this quantile loses the race next generation */
+     if (g.racequantile > 0.0 && g.npop > 0) {
+	  for (i = 0; i < g.npop; i++)
+	       racefit[i] = g.idata[i].fitness;
+	  qsort(racefit, g.npop, sizeof(racefit[0]), orderoffloat);
+	  g.racelimit = racefit[(int)(g.racequantile * (g.npop - 1))];
      }
-     putchar('\n');
+
+     /* budgets for the next generation from the reductions that finished */
+     oldmaxstep = g.maxstep;
+     oldmaxcells = g.maxcells;
+     if (g.budgetquantile > 0.0 && island0.nfinished > 0) {
+	  g.maxstep = budget(island0.finsteps, island0.nfinished, g.stepceil);
+	  g.maxcells = budget(island0.finpeaks, island0.nfinished, g.cellceil);
+	  oprintf(OUT_SYS, 50, "budget: maxstep=%d, maxcells=%d (from %d reductions)\n",
+		  g.maxstep, g.maxcells, island0.nfinished);
+     }
+     island0.nfinished = 0;
 
      g.npop = 0;
 
@@ -327,30 +1167,68 @@ int app_end_of_evaluation ( int gen, multipop *mpop, int newbest,
       * print best individual in readable form
       */
 
-     temp.tr = run_stats[0].best[0]->ind->tr;
-     set_current_individual (&temp);
-
-     indiv = evaluate_tree ( temp.tr[0].data, 0 );
-     if (indiv < 0) {
-	  /* singleton tree */
-	  indiv = Icreatebvar(indiv);
+     if (newbest)
+	  bestscored = (g.ncur == g.ncases) ? BEST_FULL : BEST_SUBSET;
+
+     /* rather the best of this generation, if scored on all the testcases */
+     shown = run_stats[0].best[0]->ind;
+     if (bestscored != BEST_FULL && g.ncur == g.ncases)
+	  shown = gen_stats[0].best[0]->ind;
+     if (newbest || !bestnfvalid || shown != run_stats[0].best[0]->ind) {
+	  temp.tr = shown->tr;
+	  indiv = translate(&temp);
+	  steps = Lbeta(indiv, CANONICAL, g.bestmaxstep, g.bestmaxcells);
+	  LLexp2str(indiv, bestnf, sizeof(bestnf));
+	  Lfree(indiv);
+	  bestnfvalid = (shown == run_stats[0].best[0]->ind);
+     }
+     if (!g.compress)
+	  oprintf ( OUT_HIS, 50, "%s\n", bestnf );
+     else {
+	  if (hisstream.fp == NULL)
+	       Zopenwrite(&hisstream, output_filehandle(OUT_HISZ), 1);
+	  Zwrite(&hisstream, bestnf, strlen(bestnf));
+	  Zwrite(&hisstream, "\n", 1);
      }
-     maxstep = 1000;
-     maxcell = 1000;
-     steps = Lbeta(indiv, CANONICAL, maxstep, maxcell);
-     LLexp2str(indiv, buf, sizeof(buf));
-
-     oprintf ( OUT_HIS, 50, "%s\n", buf );
-     Lfree(indiv);
 
      /*
-      * early termination
+      * early termination, on a distance of exactly 0; one scored on
+      * fewer testcases must be confirmed on all
       */
-     bestrawfit = run_stats[0].best[0]->ind->r_fitness;
+     bestrawfit = 1;
+     best = run_stats[0].best[0]->ind;
+     if (best->r_fitness == 0 && bestscored == BEST_FULL)
+	  bestrawfit = 0;
+     else if (best->r_fitness == 0 && bestscored == BEST_SUBSET) {
+	  bestrawfit = fullfitness(best);
+	  bestscored = (bestrawfit == 0) ? BEST_FULL : BEST_IMPERFECT;
+     }
+     best = gen_stats[0].best[0]->ind;
+     if (bestrawfit != 0 && best->r_fitness == 0)
+	  bestrawfit = (g.ncur == g.ncases) ? 0 : fullfitness(best);
      if (bestrawfit == 0)
 	  return 1;	/* perfect individual found. finish! */
-     else
-	  return 0;	/* go on to the next generation */
+
+     /*
+      * testcases for the next generation
+      */
+     if (g.stage < g.nstages - 1 &&
+	 gen_stats[0].best[0]->ind->r_fitness <= g.stagethreshold) {
+	  g.stage++;
+	  oprintf(OUT_SYS, 50, "stage %d: %d testcases\n", g.stage, stages[g.stage]);
+     }
+     if (schedule()) {
+	  g.racelimit = -1.0;	/* sums over other testcases; no race */
+	  g.cachestale = 1;
+     }
+     if (g.maxstep != oldmaxstep || g.maxcells != oldmaxcells)
+	  g.cachestale = 1;
+     if (g.fitcache) {
+	  g.problem = fingerprint();
+	  Frefresh();	/* take in what other runs found */
+     }
+
+     return 0;	/* go on to the next generation */
 }
 
 /* app_end_of_breeding()
@@ -363,9 +1241,86 @@ int app_end_of_evaluation ( int gen, multipop *mpop, int newbest,
 
 void app_end_of_breeding ( int gen, multipop *mpop )
 {
+     int i, p;
+
+     /* fitness computed with other testcases or budgets */
+     if (g.cachestale) {
+	  for (p = 0; p < mpop->size; p++)
+	       for (i = 0; i < mpop->pop[p]->size; i++)
+		    mpop->pop[p]->ind[i].evald = EVAL_CACHE_INVALID;
+	  g.cachestale = 0;
+     }
+
+     if (g.nworkers > 0)
+	  farm(mpop);
      return;
 }
 
+/*
+ * restore - take in the application state read from a checkpoint.
+ *           the parameters are those of the restarted run; the state
+ *           of the run goes on from the checkpoint.
+ */
+static void restore(void)
+{
+     struct ckstate ck;
+     struct trec t;
+     unsigned char *p;
+     long i;
+     int ok;
+
+     memcpy(&ck, ckdata, sizeof(ck));
+     if (ck.size != (int)sizeof(ck) ||
+	 (long)(sizeof(ck) + sizeof(bestnf) + ck.ntrecs * sizeof(struct trec) + ck.memolen) > cklen) {
+	  fprintf(stderr, "checkpoint: application state broken; ignored\n");
+	  goto done;
+     }
+     g.gen = ck.gen;
+     if (ck.stage >= 0 && ck.stage < g.nstages)
+	  g.stage = ck.stage;
+     g.maxstep = (ck.maxstep <= g.stepceil) ? ck.maxstep : g.stepceil;
+     g.maxcells = (ck.maxcells <= g.cellceil) ? ck.maxcells : g.cellceil;
+
+     /* the testcases must still be there, e.g. if app.testcases changed */
+     ok = ck.ncur > 0 && ck.ncur <= g.ncases;
+     for (i = 0; ok && i < ck.ncur; i++)
+	  ok = ck.cases[i] >= 0 && ck.cases[i] < g.ncases;
+     if (ok) {
+	  g.ncur = ck.ncur;
+	  memcpy(g.cases, ck.cases, sizeof(g.cases));
+	  g.racelimit = ck.racelimit;
+	  g.cachestale = ck.cachestale;
+     } else {
+	  fprintf(stderr, "checkpoint: testcases do not fit app.testcases; chosen anew\n");
+	  schedule();
+	  g.racelimit = -1.0;
+	  g.cachestale = 1;
+     }
+     if (g.fitcache)
+	  g.problem = fingerprint();
+
+     p = ckdata + sizeof(ck);
+     memcpy(bestnf, p, sizeof(bestnf));
+     bestnf[sizeof(bestnf) - 1] = '\0';
+     bestnfvalid = ck.bestnfvalid;
+     bestscored = ck.bestscored;
+     gsstarted = ck.gsstarted;
+     p += sizeof(bestnf);
+
+     for (i = 0; i < ck.ntrecs; i++, p += sizeof(t)) {
+	  memcpy(&t, p, sizeof(t));
+	  if (t.key != 0)
+	       trecstore(t.key, t.steps, t.peak);
+     }
+     if (ck.memolen > 0 && Lmemoload(p, ck.memolen) < 0)
+	  fprintf(stderr, "checkpoint: memo of normal forms broken; ignored\n");
+
+done:
+     munmap(ckmap, ckmaplen);
+     ckmap = NULL;
+     ckdata = NULL;
+}
+
 /* app_create_output_streams()
  *
  * if you are going to create any custom output streams, do it here.
@@ -377,6 +1332,19 @@ void app_end_of_breeding ( int gen, multipop *mpop )
 
 int app_create_output_streams()
 {
+     char *param;
+
+     /* compress the application's streams on the fly; see lz.c */
+     g.compress = 1;
+     if ((param = get_parameter("app.compress")) != NULL)
+	  g.compress = atoi(param);
+
+     /* statistics of every individual, in binary; see gpstat.h */
+     if (create_output_stream(OUT_STA, ".sta", 1, "w", 0) != OUTPUT_OK)
+	  return 1;
+     /* the history of best individuals goes here instead of .his */
+     if (g.compress && create_output_stream(OUT_HISZ, ".hiz", 1, "w", 0) != OUTPUT_OK)
+	  return 1;
      return 0;
 }
  
@@ -391,34 +1359,180 @@ int app_create_output_streams()
 
 int app_initialize ( int startfromcheckpoint )
 {
-     int i, j;
+     int i, n;
+     char *param, *p2;
+     long fcmax;
 
      g.blevel = 0;
      g.poilam = 1.0;
      g.debug = 0;
      Linit();
+#ifdef POSIX_MT
+     /* other threads take islands of their own; see takeisland() */
+     here = &island0;
+     island0.busy = 1;
+     if (pthread_key_create(&islandkey, giveback) != 0) {
+	  fprintf(stderr, "cannot make the key for islands\n");
+	  return 1;
+     }
+#endif
+
+     /* racing: 0 = always evaluate all the testcases */
+     g.racequantile = 0.0;
+     if ((param = get_parameter("app.race_quantile")) != NULL)
+	  g.racequantile = atof(param);
+     if (g.racequantile < 0.0 || g.racequantile > 1.0) {
+	  fprintf(stderr, "app.race_quantile must be between 0 and 1\n");
+	  return 1;
+     }
+     g.racelimit = -1.0;	/* nothing to race against yet */
+
+     /* reduce and compare at the same time */
+     g.lazy = 0;
+     if ((param = get_parameter("app.lazy")) != NULL)
+	  g.lazy = atoi(param);
+
+     /* memo of normal forms of closed subterms; works with app.lazy */
+     g.memo = 0;
+     if ((param = get_parameter("app.memo")) != NULL)
+	  g.memo = atoi(param);
+     if (g.memo < 0 || (g.memo > 0 && !g.lazy)) {
+	  fprintf(stderr, "app.memo must be >= 0, and needs app.lazy\n");
+	  return 1;
+     }
+     Lmemo(g.memo);
+
+     /* budgets of beta reduction; the limits are also the ceilings */
+     g.stepceil = 5000;
+     if ((param = get_parameter("app.maxstep")) != NULL)
+	  g.stepceil = atoi(param);
+     g.cellceil = 5000;
+     if ((param = get_parameter("app.maxcells")) != NULL)
+	  g.cellceil = atoi(param);
+     g.bestmaxstep = 1000;
+     if ((param = get_parameter("app.best_maxstep")) != NULL)
+	  g.bestmaxstep = atoi(param);
+     g.bestmaxcells = 1000;
+     if ((param = get_parameter("app.best_maxcells")) != NULL)
+	  g.bestmaxcells = atoi(param);
+     if (g.stepceil <= 0 || g.cellceil <= 0 || g.bestmaxstep <= 0 || g.bestmaxcells <= 0) {
+	  fprintf(stderr, "app.maxstep, app.maxcells and app.best_* must be positive\n");
+	  return 1;
+     }
+     g.maxstep = g.stepceil;
+     g.maxcells = g.cellceil;
+     island0.nfinished = 0;
+
+     /* adaptive budgets: 0 = keep the limits above */
+     g.budgetquantile = 0.0;
+     if ((param = get_parameter("app.budget_quantile")) != NULL)
+	  g.budgetquantile = atof(param);
+     if (g.budgetquantile < 0.0 || g.budgetquantile > 1.0) {
+	  fprintf(stderr, "app.budget_quantile must be between 0 and 1\n");
+	  return 1;
+     }
+     g.budgetfactor = 2.0;
+     if ((param = get_parameter("app.budget_factor")) != NULL)
+	  g.budgetfactor = atof(param);
+
+     /* testcases; cheapest first, for racing */
+     g.ncases = getints("app.testcases", testcases, MAXCASES);
+     if (g.ncases == 0) {
+	  g.ncases = NELEMS(deftestcases);
+	  for (i = 0; i < g.ncases; i++)
+	       testcases[i] = deftestcases[i];
+     }
+     for (i = 0; i < g.ncases; i++)
+	  if (testcases[i] < 0)
+	       break;
+     if (g.ncases < 0 || i < g.ncases) {
+	  fprintf(stderr, "app.testcases must be up to %d numbers >= 0\n", MAXCASES);
+	  return 1;
+     }
+     qsort(testcases, g.ncases, sizeof(testcases[0]), orderofint);
+
+     /* curriculum; the last stage always has all the testcases */
+     g.nstages = getints("app.curriculum", stages, MAXCASES);
+     for (i = 0; i < g.nstages; i++)
+	  if (stages[i] <= (i > 0 ? stages[i-1] : 0) || stages[i] > g.ncases)
+	       break;
+     if (g.nstages < 0 || i < g.nstages) {
+	  fprintf(stderr, "app.curriculum must be increasing #testcases up to %d\n", g.ncases);
+	  return 1;
+     }
+     if (g.nstages == 0 || stages[g.nstages-1] < g.ncases)
+	  stages[g.nstages++] = g.ncases;
+     g.stage = 0;
+     g.stagethreshold = 0.0;
+     if ((param = get_parameter("app.stage_threshold")) != NULL)
+	  g.stagethreshold = atof(param);
+     g.subsample = 0;
+     if ((param = get_parameter("app.subsample")) != NULL)
+	  g.subsample = atoi(param);
+     g.ncur = 0;
+     schedule();
+
+     build(&island0);
 
      /*
-      * pgplot initialize
+      * sized from the parameters here; g.idata[] grows if the
+      * population turns out to be larger
       */
-     cpgopen("?");
-     cpgenv(0.0, (float)MAXGEN, 0.0, (float)MAXPOP, 0, 2);
-     cpglab("generation", "population", "size (green) and fitness (blue) of individuals");
-
-     /* set up color index */
-     for (j = 0; j < 10; j++)
-	  cpgscr(j, 1.0, 0.0, 0.0);
-
-     for (i = 1; i < 10; i++)
-	  for (j = 0; j < 10; j++)
-	       cpgscr(i*10+j, 0.0, i/10.0, j/10.0);
+     n = 1000;
+     if ((param = get_parameter("pop_size")) != NULL)
+	  n = atoi(param);
+     if ((param = get_parameter("multiple.subpops")) != NULL && atoi(param) > 1)
+	  n *= atoi(param);
+     if (n <= 0) {
+	  fprintf(stderr, "pop_size must be positive\n");
+	  return 1;
+     }
+     g.maxpop = 0;
+     reserve(n);
 
      g.npop = 0;
      g.gen = 0;
+     g.cachestale = 0;
+
+     /* fitness cache file shared with other runs */
+     g.fitcache = 0;
+     if ((param = get_parameter("app.fitcache")) != NULL && *param != '\0') {
+	  fcmax = 100000;
+	  if ((p2 = get_parameter("app.fitcache_max")) != NULL)
+	       fcmax = atol(p2);
+	  if (Fopen(param, fcmax) < 0) {
+	       fprintf(stderr, "cannot use fitness cache %s\n", param);
+	       return 1;
+	  }
+	  g.fitcache = 1;
+	  g.problem = fingerprint();
+     }
 
-     /* params for visualize; note: log a(X)/log a(D) = log b(X)/log b(D) */
-     g.ncelldenom = log10((double)CELLSCEIL);
-     g.distdenom = log10((double)DISTCEIL);
+     /* put the memo of normal forms in checkpoints */
+     checkpointmemo = 1;
+     if ((param = get_parameter("app.checkpoint_memo")) != NULL)
+	  checkpointmemo = atoi(param);
+
+     /* read before this by app_read_checkpoint() */
+     initialized = 1;
+     if (ckdata != NULL)
+	  restore();
+
+     /* forked last, to have all the above */
+     g.nworkers = 0;
+     g.stepspernode = 1.0;
+     if ((param = get_parameter("app.workers")) != NULL)
+	  g.nworkers = atoi(param);
+     if (g.nworkers < 0) {
+	  fprintf(stderr, "app.workers must be >= 0\n");
+	  return 1;
+     }
+     if (g.nworkers > 0 &&
+	 Wstart(g.nworkers, g.maxpop, WORKERARENA, sizeof(struct batch),
+		sizeof(struct outcome), work) < 0) {
+	  fprintf(stderr, "cannot start %d workers\n", g.nworkers);
+	  return 1;
+     }
 
      return 0;
 }
@@ -430,7 +1544,62 @@ int app_initialize ( int startfromcheckpoint )
 
 void app_uninitialize ( void )
 {
-     cpgclos();
+     struct island *is;
+     int i;
+
+     for (i = 0; i < g.ncases; i++) {
+	  Lfree(island0.samples[i]);
+	  Lfree(island0.targets[i]);
+     }
+     while ((is = island0.next) != NULL) {
+	  island0.next = is->next;
+	  Lfreestate(is->engine);	/* with its numerals and memo */
+	  FREE(is->finsteps);
+	  FREE(is->finpeaks);
+	  FREE(is->done);
+	  FREE(is);
+     }
+#ifdef POSIX_MT
+     pthread_key_delete(islandkey);
+#endif
+
+     if (g.nworkers > 0)
+	  Wstop();
+     FREE(farmjobs);
+     FREE(farmed);
+     farmjobs = NULL;
+     farmed = NULL;
+     maxfarmjobs = nfarmed = 0;
+
+     Lmemo(0);
+     if (g.fitcache)
+	  Fclose();
+     Zclose(&stastream);
+     Zclose(&hisstream);
+     gsstarted = 0;
+     initialized = 0;
+
+     FREE(g.idata);
+     FREE(racefit);
+     FREE(trecs);
+     FREE(gsncells);
+     FREE(gsfitness);
+     FREE(gsstatus);
+     FREE(gssteps);
+     FREE(gspeak);
+     FREE(island0.finsteps);
+     FREE(island0.finpeaks);
+     FREE(island0.done);
+     g.idata = NULL;
+     racefit = NULL;
+     trecs = NULL;
+     gsncells = gssteps = gspeak = NULL;
+     gsfitness = NULL;
+     gsstatus = NULL;
+     island0.finsteps = island0.finpeaks = NULL;
+     island0.done = NULL;
+     island0.nfinished = island0.ndone = 0;
+     g.maxpop = island0.maxfinished = island0.maxdone = 0;
      return;
 }
 
@@ -443,6 +1612,37 @@ void app_uninitialize ( void )
 
 void app_read_checkpoint ( FILE *f )
 {
+     int version;
+     long len;
+     off_t pos;
+
+     if (fscanf(f, " lambda-gp checkpoint %d %ld", &version, &len) != 2 ||
+	 getc(f) != '\n') {
+	  fprintf(stderr, "no application state in the checkpoint\n");
+	  return;
+     }
+     pos = ftello(f);
+     if (version != CK_VERSION || len < (long)sizeof(struct ckstate)) {
+	  fprintf(stderr, "checkpoint: application state of version %d ignored\n", version);
+	  fseeko(f, pos + len, SEEK_SET);
+	  return;
+     }
+
+     /* mapped from the beginning of the file, as mmap needs */
+     ckmaplen = pos + len;
+     ckmap = mmap(NULL, ckmaplen, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+     fseeko(f, pos + len, SEEK_SET);
+     if (ckmap == MAP_FAILED) {
+	  perror("checkpoint");
+	  ckmap = NULL;
+	  return;
+     }
+     ckdata = (unsigned char *)ckmap + pos;
+     cklen = len;
+
+     /* otherwise app_initialize() does it */
+     if (initialized)
+	  restore();
      return;
 }
 
@@ -455,6 +1655,54 @@ void app_read_checkpoint ( FILE *f )
 
 void app_write_checkpoint ( FILE *f )
 {
+     struct ckstate *ck;
+     unsigned char *buf;
+     long len, i, n;
+
+     /* what is in the files must go with the checkpoint */
+     Zflush(&stastream);
+     Zflush(&hisstream);
+
+     len = sizeof(struct ckstate) + sizeof(bestnf) + ntrecs * sizeof(struct trec);
+     if (checkpointmemo)
+	  len += Lmemodump(NULL, 0);
+     if ((buf = calloc(len, 1)) == NULL) {
+	  fprintf(stderr, "checkpoint: cannot allocate %ld bytes\n", len);
+	  fprintf(f, "lambda-gp checkpoint %d %d\n", CK_VERSION, 0);
+	  return;
+     }
+
+     ck = (struct ckstate *)buf;
+     ck->size = sizeof(struct ckstate);
+     ck->gen = g.gen;
+     ck->stage = g.stage;
+     ck->ncur = g.ncur;
+     memcpy(ck->cases, g.cases, sizeof(ck->cases));
+     ck->racelimit = g.racelimit;
+     ck->maxstep = g.maxstep;
+     ck->maxcells = g.maxcells;
+     ck->cachestale = g.cachestale;
+     ck->bestnfvalid = bestnfvalid;
+     ck->bestscored = bestscored;
+     ck->gsstarted = gsstarted;
+     memcpy(buf + sizeof(*ck), bestnf, sizeof(bestnf));
+
+     /* the tree records that are used */
+     n = 0;
+     for (i = 0; i <= (long)trecmask && trecs != NULL; i++)
+	  if (trecs[i].key != 0) {
+	       memcpy(buf + sizeof(*ck) + sizeof(bestnf) + n * sizeof(struct trec),
+		      &trecs[i], sizeof(struct trec));
+	       n++;
+	  }
+     ck->ntrecs = n;
+     if (checkpointmemo)
+	  ck->memolen = Lmemodump(buf + sizeof(*ck) + sizeof(bestnf) + n * sizeof(struct trec),
+				  len - sizeof(*ck) - sizeof(bestnf) - n * sizeof(struct trec));
+
+     fprintf(f, "lambda-gp checkpoint %d %ld\n", CK_VERSION, len);
+     fwrite(buf, 1, len, f);
+     FREE(buf);
      return;
 }
 
@@ -42,32 +42,67 @@
  */
 
 enum {
-  MAXPOP = 1000,
-  MAXGEN = 1000,
-  CELLSCEIL = 10000,	/* for visualize; should be in accordance with in.xxx */
-  DISTCEIL = 20000,	/* for visualize; typical value = sum of worst raw fitness + alpha */
+  MAXCASES = 32,	/* max #testcases */
   IPENALTY = 10000,	/* penalty distance for identity function */
+  TARGETFACTOR = 2,	/* the answer for testcase n is n*TARGETFACTOR */
+  WORKERARENA = 64 << 20,	/* bytes of trees a generation for the workers */
 };
 
 typedef struct
 {
      Var blevel;	/* level of binding; root=0 */
      double poilam;	/* lambda parameter for Poisson random value generation */
-     double ncelldenom;	/* for visualize; denominator for log10(ncells) to fit within 0-1 */
-     double distdenom;	/* for visualize; coefficient for log10(sum of dist) to fit within 0-1 */
+     /* fitness cases */
+     int ncases;	/* #testcases */
+     int stage, nstages;	/* of the curriculum */
+     double stagethreshold;	/* best raw fitness to go on to the next stage */
+     int subsample;	/* #testcases to pick at random; 0 = all */
+     int cases[MAXCASES];	/* testcases of this generation */
+     int ncur;
+     /* racing */
+     double racequantile;	/* quantile of last generation's raw fitness to race against; 0 = off */
+     double racelimit;	/* sum of distances that loses the race; < 0 = no race */
+     int lazy;		/* reduce only as far as the distance needs */
+     int memo;		/* #entries of the memo of normal forms; 0 = none */
+     /* budgets of beta reduction */
+     int maxstep, maxcells;	/* for this generation */
+     int stepceil, cellceil;	/* never beyond these */
+     int bestmaxstep, bestmaxcells;	/* for printing the best individual */
+     double budgetquantile;	/* quantile of finished reductions to adapt to; 0 = fixed */
+     double budgetfactor;	/* margin over the quantile */
+     int cachestale;	/* cached fitness must be evaluated again */
+     int fitcache;	/* use the fitness cache file */
+     unsigned long problem;	/* fingerprint of the problem for the file */
+     int compress;	/* compress the statistics and history streams */
+     int nworkers;	/* worker processes evaluating the population; 0 = none */
+     double stepspernode;	/* median of the last generation, for the workers */
      /* misc */
      int debug;
      /* data */
      int gen;
      int npop;
+     int maxpop;	/* #elements of idata; grows with the population */
      struct iinfo {
 	  int	ncells;
 	  float	fitness;
-	  int	reduction_finished;
-     } idata[MAXPOP];
+	  int	steps;	/* total beta steps; -1 = unknown */
+	  int	peak;	/* peak #cells; -1 = unknown */
+	  unsigned char	reduction_finished;
+	  unsigned char	bounded;	/* lost the race; fitness is a lower bound */
+     } *idata;
 } globaldata;
 
 /* leave this definition in if you pass information via globaldata. */
 extern globaldata g;
 
+/*
+ * tracing of the evaluation path.  nothing is formatted unless g.debug
+ * is set; compile with -DNOTRACE to drop the tracing code altogether.
+ */
+#ifdef NOTRACE
+#define tracing()	0
+#else
+#define tracing()	(g.debug)
+#endif
+
 #endif
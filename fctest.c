@@ -0,0 +1,114 @@
+/*
+ * fctest.c - test of the fitness cache reading past torn records
+ *
+ * A short append (as left by a crash) shifts all the records after it;
+ * they must still be found, by Frefresh() in the process that has the
+ * cache open and by Fopen() afterwards.
+ *
+ * usage: fctest [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "fitcache.h"
+
+#define PROBLEM		12345UL
+#define NKEYS		6
+
+static char *path = "fctest.tmp";
+static int nfail = 0;
+
+/* append len junk bytes behind the back of the cache */
+static void
+torn(int len)
+{
+     char junk[64];
+     int fd, i;
+
+     for (i = 0; i < len; i++)
+	  junk[i] = (char)(0xa5 + 7 * i);
+     if ((fd = open(path, O_WRONLY | O_APPEND)) < 0 ||
+	 write(fd, junk, len) != len) {
+	  perror(path);
+	  exit(2);
+     }
+     close(fd);
+}
+
+/* store keys from..to-1 as another process would */
+static void
+store(int from, int to)
+{
+     pid_t pid;
+     int k, status;
+
+     if ((pid = fork()) < 0) {
+	  perror("fork");
+	  exit(2);
+     }
+     if (pid == 0) {
+	  if (Fopen(path, 100) < 0)
+	       _exit(2);
+	  for (k = from; k < to; k++)
+	       Fstore(Fmix(0, k), PROBLEM, 10.0 * k, k);
+	  Fclose();
+	  _exit(0);
+     }
+     if (waitpid(pid, &status, 0) < 0 || status != 0) {
+	  fprintf(stderr, "fctest: child failed\n");
+	  exit(2);
+     }
+}
+
+/* are keys 0..n-1 all there? */
+static void
+expect(char *when, int n)
+{
+     double r_fitness;
+     int k, hits;
+
+     for (k = 0; k < n; k++)
+	  if (!Flookup(Fmix(0, k), PROBLEM, &r_fitness, &hits) ||
+	      r_fitness != 10.0 * k || hits != k) {
+	       printf("FAIL %s: key %d lost\n", when, k);
+	       nfail++;
+	  }
+}
+
+int
+main(int argc, char **argv)
+{
+     if (argc > 1)
+	  path = argv[1];
+     unlink(path);
+
+     if (Fopen(path, 100) < 0)
+	  return 2;
+     Fstore(Fmix(0, 0), PROBLEM, 0.0, 0);
+     torn(20);		/* in the middle */
+     store(1, 3);
+     torn(13);		/* at the end, then records after it */
+     Frefresh();
+     expect("refresh", 3);
+     store(3, NKEYS);
+     Frefresh();
+     expect("refresh after tail", NKEYS);
+     Fclose();
+
+     if (Fopen(path, 100) < 0)
+	  return 2;
+     expect("reopen", NKEYS);
+     Fclose();
+
+     unlink(path);
+     if (nfail == 0)
+	  printf("fctest: OK\n");
+     return nfail != 0;
+}
+
+/* [EOF] */
@@ -0,0 +1,294 @@
+/*
+ * fitcache.c - persistent fitness cache shared among gp processes
+ *
+ * The cache is a file of fixed-size records, each appended by a single
+ * write(2) to a descriptor opened with O_APPEND, so that gp processes
+ * running at the same time can add to it without locking.  A record
+ * holds the hash of a term, the fingerprint of the problem it was
+ * evaluated for, and the result.  On opening, the file is mapped and
+ * its records are put in an index in memory; Frefresh() reads the
+ * records appended since then.  A record that does not check out
+ * (e.g., torn by a crash) is ignored, and reading resumes at the next
+ * byte that starts one that does, as a short write shifts all the
+ * records after it.  Nothing is appended once the
+ * file has the maximum #records given to Fopen().  With POSIX_MT,
+ * Flookup() and Fstore() may be called by the threads of a process at
+ * the same time; the others may not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef POSIX_MT
+#include <pthread.h>
+#endif
+
+#include "fitcache.h"
+
+#ifdef POSIX_MT
+static pthread_mutex_t fclock = PTHREAD_MUTEX_INITIALIZER;	/* for the index */
+#define FCLOCK()	pthread_mutex_lock(&fclock)
+#define FCUNLOCK()	pthread_mutex_unlock(&fclock)
+#else
+#define FCLOCK()
+#define FCUNLOCK()
+#endif
+
+enum {
+     FC_VERSION = 1,
+     FC_READBUF = 1024,	/* #records read at a time by Frefresh() */
+};
+
+#define FC_MAGIC	0x6c67706669746331UL	/* "lgpfitc1" */
+
+/* record in the file */
+struct fcrecord {
+     unsigned long key;		/* hash of the term */
+     unsigned long problem;	/* fingerprint of the problem */
+     double r_fitness;
+     int hits;
+     int version;
+     unsigned long check;
+};
+
+/* entry of the index in memory */
+struct fcentry {
+     unsigned long key;
+     unsigned long problem;
+     double r_fitness;
+     int hits;
+     int used;
+};
+
+static int fcfd = -1;
+static struct fcentry *fcindex;
+static unsigned long fcmask;		/* #entries of fcindex - 1 */
+static long fcmax;			/* max #records */
+static long fcnrec;			/* #records in the file, as far as known */
+static long fcnent;			/* #entries used */
+static off_t fcseen;			/* bytes of the file indexed */
+
+static unsigned long
+fccheck(struct fcrecord *r)
+{
+     unsigned long h;
+     unsigned long fbits;
+
+     memcpy(&fbits, &r->r_fitness, sizeof(fbits));
+     h = Fmix(FC_MAGIC, r->key);
+     h = Fmix(h, r->problem);
+     h = Fmix(h, fbits);
+     h = Fmix(h, (unsigned long)r->hits);
+     return Fmix(h, (unsigned long)r->version);
+}
+
+static struct fcentry *
+fcslot(unsigned long key, unsigned long problem)
+{
+     unsigned long i;
+
+     for (i = (key ^ problem) & fcmask; ; i = (i + 1) & fcmask)
+	  if (!fcindex[i].used ||
+	      (fcindex[i].key == key && fcindex[i].problem == problem))
+	       return &fcindex[i];
+}
+
+/* returns 0 if r does not check out */
+static int
+fcindexrecord(struct fcrecord *r)
+{
+     struct fcentry *e;
+
+     if (r->version != FC_VERSION || r->check != fccheck(r))
+	  return 0;
+     e = fcslot(r->key, r->problem);
+     if (!e->used) {
+	  if (fcnent >= fcmax)
+	       return 1;
+	  fcnent++;
+     }
+     e->key = r->key;
+     e->problem = r->problem;
+     e->r_fitness = r->r_fitness;
+     e->hits = r->hits;
+     e->used = 1;
+     return 1;
+}
+
+/*
+ * fcscan - index the records in the len bytes at p, wherever they
+ *          start.  returns #bytes done with; fewer than a record are left.
+ */
+static off_t
+fcscan(const char *p, off_t len)
+{
+     struct fcrecord r;
+     off_t i;
+
+     i = 0;
+     while (len - i >= (off_t)sizeof(r)) {
+	  memcpy(&r, p + i, sizeof(r));	/* p + i may be misaligned */
+	  if (fcindexrecord(&r))
+	       i += sizeof(r);
+	  else
+	       i++;
+     }
+     return i;
+}
+
+/*
+ * Fmix - mix v into hash h; for the keys and fingerprints
+ */
+unsigned long
+Fmix(unsigned long h, unsigned long v)
+{
+     h ^= v + 0x9e3779b97f4a7c15UL + (h << 6) + (h >> 2);
+     h *= 0xff51afd7ed558ccdUL;
+     h ^= h >> 33;
+     return h;
+}
+
+/*
+ * Fopen - open (or create) the cache file and index its records.
+ *         maxrec limits the #records.  returns 0 if OK, -1 if not.
+ */
+int
+Fopen(char *path, long maxrec)
+{
+     struct stat st;
+     char *recs;
+     unsigned long n;
+
+     if (maxrec <= 0)
+	  return -1;
+     if ((fcfd = open(path, O_RDWR | O_CREAT | O_APPEND, 0666)) < 0) {
+	  perror(path);
+	  return -1;
+     }
+
+     /* twice as many entries as records, to keep the probes short */
+     for (n = 1; n < 2 * (unsigned long)maxrec; n <<= 1)
+	  ;
+     if ((fcindex = calloc(n, sizeof(fcindex[0]))) == NULL) {
+	  fprintf(stderr, "Fopen: cannot allocate index of %lu entries\n", n);
+	  close(fcfd);
+	  fcfd = -1;
+	  return -1;
+     }
+     fcmask = n - 1;
+     fcmax = maxrec;
+     fcnent = 0;
+
+     if (fstat(fcfd, &st) < 0) {
+	  perror(path);
+	  Fclose();
+	  return -1;
+     }
+     fcseen = 0;
+     if (st.st_size >= (off_t)sizeof(struct fcrecord)) {
+	  recs = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fcfd, 0);
+	  if (recs == MAP_FAILED) {
+	       perror(path);
+	       Fclose();
+	       return -1;
+	  }
+	  fcseen = fcscan(recs, st.st_size);
+	  munmap(recs, st.st_size);
+     }
+     fcnrec = st.st_size / sizeof(struct fcrecord);
+     return 0;
+}
+
+void
+Fclose(void)
+{
+     if (fcfd >= 0)
+	  close(fcfd);
+     fcfd = -1;
+     free(fcindex);
+     fcindex = NULL;
+}
+
+/*
+ * Frefresh - index the records appended since the last time,
+ *            by this process or others
+ */
+void
+Frefresh(void)
+{
+     struct stat st;
+     char buf[FC_READBUF * sizeof(struct fcrecord)];
+     ssize_t len;
+     off_t n;
+
+     if (fcfd < 0 || fstat(fcfd, &st) < 0)
+	  return;
+     while (st.st_size - fcseen >= (off_t)sizeof(struct fcrecord)) {
+	  n = st.st_size - fcseen;
+	  if (n > (off_t)sizeof(buf))
+	       n = sizeof(buf);
+	  len = pread(fcfd, buf, n, fcseen);
+	  if (len < (ssize_t)sizeof(struct fcrecord))
+	       return;
+	  fcseen += fcscan(buf, len);
+     }
+     if (st.st_size / (off_t)sizeof(struct fcrecord) > fcnrec)
+	  fcnrec = st.st_size / sizeof(struct fcrecord);
+}
+
+/*
+ * Flookup - get the result for the term of hash key in problem.
+ *           returns 1 if found, 0 if not.
+ */
+int
+Flookup(unsigned long key, unsigned long problem, double *r_fitness, int *hits)
+{
+     struct fcentry *e;
+     int found;
+
+     if (fcfd < 0)
+	  return 0;
+     FCLOCK();
+     e = fcslot(key, problem);
+     found = e->used;
+     if (found) {
+	  *r_fitness = e->r_fitness;
+	  *hits = e->hits;
+     }
+     FCUNLOCK();
+     return found;
+}
+
+/*
+ * Fstore - record the result for the term of hash key in problem
+ */
+void
+Fstore(unsigned long key, unsigned long problem, double r_fitness, int hits)
+{
+     struct fcrecord r;
+
+     if (fcfd < 0)
+	  return;
+     memset(&r, 0, sizeof(r));
+     r.key = key;
+     r.problem = problem;
+     r.r_fitness = r_fitness;
+     r.hits = hits;
+     r.version = FC_VERSION;
+     r.check = fccheck(&r);
+     FCLOCK();
+     if (fcnrec < fcmax && write(fcfd, &r, sizeof(r)) == sizeof(r)) {
+	  /* partly written one is ignored when read */
+	  fcnrec++;
+	  fcindexrecord(&r);
+     }
+     FCUNLOCK();
+}
+
+/* [EOF] */
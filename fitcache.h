@@ -0,0 +1,18 @@
+/*
+ * fitcache.h - persistent fitness cache shared among gp processes
+ *
+ */
+
+#ifndef _FITCACHE_H
+#define _FITCACHE_H
+
+int Fopen(char *, long);
+void Fclose(void);
+void Frefresh(void);
+int Flookup(unsigned long, unsigned long, double *, int *);
+void Fstore(unsigned long, unsigned long, double, int);
+unsigned long Fmix(unsigned long, unsigned long);
+
+#endif /* _FITCACHE_H */
+
+/* [EOF] */
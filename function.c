@@ -114,7 +114,7 @@ void f_variable_gen ( DATATYPE *v )
 	  pi *= random_double();
      
      assert(k != 0);
-     if (g.debug)
+     if (tracing())
 	  printf("[%d]", k);
      *v = (DATATYPE)(-k);
 }
@@ -58,4 +58,8 @@ DATATYPE f_application ( int tree, farg *args );
 void f_variable_gen ( DATATYPE *v );
 char *f_variable_print ( DATATYPE v );
 
+/* lambint.c; builds the lexp without the functions above */
+int Itree2debruijn ( lnode *data, int size, int types[], Var idx[] );
+Lexp Itree2lexp ( lnode *data, int size );
+
 #endif
@@ -0,0 +1,221 @@
+/*
+ * gpplot.c - render the statistics stream (.sta) written by gp
+ *
+ * usage: gpplot [-o output.ps] [-c cellsceil] [-d distceil] file
+ *
+ * draws the picture gp used to draw with PGPLOT while running: one
+ * column per generation, one box per individual in order of size,
+ * green for the size and blue for the fitness of individuals whose
+ * reductions finished, red for the others.  the output is PostScript,
+ * written without any graphics library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "gpstat.h"
+
+enum {
+     CELLSCEIL = 10000,	/* typical max #cells; should be in accordance with in.xxx */
+     DISTCEIL = 20000,	/* typical value = sum of worst raw fitness + alpha */
+};
+
+/* page layout, in points */
+#define PX0	72.0
+#define PY0	160.0
+#define PW	468.0
+#define PH	468.0
+
+/* boxes of the same color in a column are drawn as one */
+struct run {
+     int gen;
+     int from, to;	/* rows [from, to) */
+     int color;
+};
+
+static struct run *runs;
+static long nruns, maxruns;
+
+static double ncelldenom;	/* denominator for log10(ncells) to fit within 0-1 */
+static double distdenom;	/* coefficient for log10(sum of dist) to fit within 0-1 */
+
+static struct gsrows rows;
+
+/*
+ * color - color index of an individual; 0 = red, or
+ *         10*sizerank + fitnessrank
+ */
+static int
+color(int ncells, float fitness, int status)
+{
+     int sizerank, fitnessrank;
+
+     if (status != GS_FINISHED)
+	  return 0;
+
+     /* 1 <= sizerank <= 9 */
+     sizerank = log10((double)ncells+10.0) / ncelldenom * 9 + 1;
+     if (sizerank > 9)
+	  sizerank = 9;
+
+     /* 0 <= fitnessrank <= 9; the larger the fitter */
+     fitnessrank = 9 - (int)(log10((double)fitness+10.0) / distdenom * 10.0);
+     if (fitnessrank < 0)
+	  fitnessrank = 0;
+
+     return sizerank * 10 + fitnessrank;
+}
+
+static void
+addrun(int gen, int from, int to, int c)
+{
+     if (nruns >= maxruns) {
+	  maxruns = (maxruns > 0) ? maxruns * 2 : 4096;
+	  if ((runs = realloc(runs, maxruns * sizeof(runs[0]))) == NULL) {
+	       fprintf(stderr, "gpplot: cannot allocate for %ld boxes\n", maxruns);
+	       exit(1);
+	  }
+     }
+     runs[nruns].gen = gen;
+     runs[nruns].from = from;
+     runs[nruns].to = to;
+     runs[nruns].color = c;
+     nruns++;
+}
+
+/*
+ * ticks - step of the ticks for an axis up to max
+ */
+static double
+ticks(double max)
+{
+     double step;
+
+     step = pow(10.0, floor(log10(max > 1.0 ? max : 1.0)));
+     if (max / step < 2.0)
+	  step /= 5.0;
+     else if (max / step < 5.0)
+	  step /= 2.0;
+     return step >= 1.0 ? step : 1.0;
+}
+
+static void
+render(FILE *out, int maxgen, int maxpop)
+{
+     double sx, sy, t, step;
+     long i;
+     int c;
+
+     sx = PW / maxgen;
+     sy = PH / maxpop;
+
+     fprintf(out, "%%!PS-Adobe-3.0\n");
+     fprintf(out, "%%%%BoundingBox: 0 0 612 792\n");
+     fprintf(out, "%%%%Creator: gpplot\n");
+     fprintf(out, "%%%%EndComments\n");
+     fprintf(out, "/b { newpath moveto 1 index 0 rlineto 0 exch rlineto neg 0 rlineto closepath fill } def\n");
+     fprintf(out, "/Helvetica findfont 10 scalefont setfont\n");
+
+     for (i = 0; i < nruns; i++) {
+	  c = runs[i].color;
+	  if (c == 0)
+	       fprintf(out, "1 0 0 setrgbcolor ");
+	  else
+	       fprintf(out, "0 %g %g setrgbcolor ", (c / 10) / 10.0, (c % 10) / 10.0);
+	  fprintf(out, "%.3f %.3f %.3f %.3f b\n", sx, (runs[i].to - runs[i].from) * sy,
+		  PX0 + runs[i].gen * sx, PY0 + runs[i].from * sy);
+     }
+
+     /* frame, ticks and labels */
+     fprintf(out, "0 setgray 0.5 setlinewidth\n");
+     fprintf(out, "newpath %g %g moveto %g 0 rlineto 0 %g rlineto %g 0 rlineto closepath stroke\n",
+	     PX0, PY0, PW, PH, -PW);
+     step = ticks(maxgen);
+     for (t = 0.0; t <= maxgen; t += step)
+	  fprintf(out, "newpath %.3f %g moveto 0 -4 rlineto stroke %.3f %g moveto (%g) show\n",
+		  PX0 + t * sx, PY0, PX0 + t * sx - 4.0, PY0 - 14.0, t);
+     step = ticks(maxpop);
+     for (t = 0.0; t <= maxpop; t += step)
+	  fprintf(out, "newpath %g %.3f moveto -4 0 rlineto stroke %g %.3f moveto (%g) show\n",
+		  PX0, PY0 + t * sy, PX0 - 30.0, PY0 + t * sy - 3.0, t);
+     fprintf(out, "%g %g moveto (generation) show\n", PX0 + PW / 2.0 - 25.0, PY0 - 32.0);
+     fprintf(out, "gsave %g %g translate 90 rotate 0 0 moveto (population) show grestore\n",
+	     PX0 - 40.0, PY0 + PH / 2.0 - 25.0);
+     fprintf(out, "%g %g moveto (size \\(green\\) and fitness \\(blue\\) of individuals) show\n",
+	     PX0 + PW / 2.0 - 110.0, PY0 + PH + 12.0);
+     fprintf(out, "showpage\n%%%%EOF\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+     FILE *fp, *out;
+     char *outname;
+     struct gsblock b;
+     int c, i, from, r, maxgen, maxpop;
+
+     outname = NULL;
+     ncelldenom = log10((double)CELLSCEIL);
+     distdenom = log10((double)DISTCEIL);
+     while ((c = getopt(argc, argv, "o:c:d:")) != -1) {
+	  switch (c) {
+	  case 'o':
+	       outname = optarg;
+	       break;
+	  case 'c':
+	       ncelldenom = log10(atof(optarg));
+	       break;
+	  case 'd':
+	       distdenom = log10(atof(optarg));
+	       break;
+	  default:
+	       optind = argc + 1;
+	       break;
+	  }
+     }
+     if (optind != argc - 1 || ncelldenom <= 0.0 || distdenom <= 0.0) {
+	  fprintf(stderr, "usage: gpplot [-o output.ps] [-c cellsceil] [-d distceil] file\n");
+	  exit(2);
+     }
+
+     if ((fp = fopen(argv[optind], "r")) == NULL) {
+	  perror(argv[optind]);
+	  exit(1);
+     }
+     if (gsreadhead(fp, argv[optind]) < 0)
+	  exit(1);
+     maxgen = maxpop = 1;
+     while ((r = gsreadblock(fp, argv[optind], &b, &rows)) > 0) {
+	  if (b.gen + 1 > maxgen)
+	       maxgen = b.gen + 1;
+	  if (b.n > maxpop)
+	       maxpop = b.n;
+	  for (from = i = 0; i < b.n; i++) {
+	       c = color(rows.ncells[i], rows.fitness[i], rows.status[i]);
+	       if (i + 1 == b.n ||
+		   c != color(rows.ncells[i+1], rows.fitness[i+1], rows.status[i+1])) {
+		    addrun(b.gen, from, i + 1, c);
+		    from = i + 1;
+	       }
+	  }
+     }
+     fclose(fp);
+     if (r < 0)
+	  fprintf(stderr, "gpplot: rendering what was read\n");
+
+     if (outname == NULL)
+	  out = stdout;
+     else if ((out = fopen(outname, "w")) == NULL) {
+	  perror(outname);
+	  exit(1);
+     }
+     render(out, maxgen, maxpop);
+     if (out != stdout)
+	  fclose(out);
+     return 0;
+}
+
+/* [EOF] */
@@ -0,0 +1,142 @@
+/*
+ * gpstat.c - read the statistics stream (.sta) written by gp
+ *
+ * usage: gpstat [-a | -c] [file ...]
+ *
+ * prints one line per generation: generation, #individuals, #testcases,
+ * mean ncells, best fitness, #finished, #bounded, mean steps and max
+ * peak #cells.  with -a, prints every individual instead.  with -c,
+ * decompresses any stream of gp (e.g., .hiz) to the standard output.
+ * reads the standard input if no file is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpstat.h"
+#include "lz.h"
+
+static int allrows = 0;
+static int catonly = 0;
+
+static struct gsrows rows;
+
+static void
+printblock(struct gsblock *b)
+{
+     int i, nfinished, nbounded, nsteps, maxpeak;
+     double sumcells, sumsteps;
+     float best;
+
+     if (allrows) {
+	  for (i = 0; i < b->n; i++)
+	       printf("%d\t%d\t%d\t%g\t%d\t%d\t%d\n", b->gen, i, rows.ncells[i],
+		      rows.fitness[i], rows.status[i], rows.steps[i], rows.peak[i]);
+	  return;
+     }
+
+     sumcells = sumsteps = 0.0;
+     nfinished = nbounded = nsteps = 0;
+     maxpeak = -1;
+     best = -1.0;
+     for (i = 0; i < b->n; i++) {
+	  sumcells += rows.ncells[i];
+	  if (best < 0.0 || rows.fitness[i] < best)
+	       best = rows.fitness[i];
+	  if (rows.status[i] == GS_FINISHED)
+	       nfinished++;
+	  else if (rows.status[i] == GS_BOUNDED)
+	       nbounded++;
+	  if (rows.steps[i] >= 0) {
+	       sumsteps += rows.steps[i];
+	       nsteps++;
+	  }
+	  if (rows.peak[i] > maxpeak)
+	       maxpeak = rows.peak[i];
+     }
+     printf("%d\t%d\t%d\t%.1f\t%g\t%d\t%d\t%.1f\t%d\n", b->gen, b->n, b->ncases,
+	    b->n > 0 ? sumcells / b->n : 0.0, best, nfinished, nbounded,
+	    nsteps > 0 ? sumsteps / nsteps : -1.0, maxpeak);
+}
+
+/*
+ * catstream - copy a stream, decompressed, to the standard output
+ */
+static int
+catstream(FILE *fp, char *name)
+{
+     struct zstream z;
+     char buf[BUFSIZ];
+     int n;
+
+     Zopenread(&z, fp);
+     while ((n = Zread(&z, buf, sizeof(buf))) > 0)
+	  fwrite(buf, 1, n, stdout);
+     Zclose(&z);
+     return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * readstream - print the blocks of one stream.  returns 0 if OK.
+ */
+static int
+readstream(FILE *fp, char *name)
+{
+     struct gsblock b;
+     int r;
+
+     if (catonly)
+	  return catstream(fp, name);
+     if (gsreadhead(fp, name) < 0)
+	  return -1;
+     while ((r = gsreadblock(fp, name, &b, &rows)) > 0)
+	  printblock(&b);
+     return r;
+}
+
+int
+main(int argc, char *argv[])
+{
+     FILE *fp;
+     int c, i, ret;
+
+     while ((c = getopt(argc, argv, "ac")) != -1) {
+	  switch (c) {
+	  case 'a':
+	       allrows = 1;
+	       break;
+	  case 'c':
+	       catonly = 1;
+	       break;
+	  default:
+	       fprintf(stderr, "usage: gpstat [-a | -c] [file ...]\n");
+	       exit(2);
+	  }
+     }
+
+     if (catonly)
+	  ;
+     else if (allrows)
+	  printf("#gen\tindex\tncells\tfitness\tstatus\tsteps\tpeak\n");
+     else
+	  printf("#gen\tnpop\tncases\tncells\tbest\tfinished\tbounded\tsteps\tpeak\n");
+
+     ret = 0;
+     if (optind >= argc)
+	  ret = readstream(stdin, "(stdin)");
+     for (i = optind; i < argc; i++) {
+	  if ((fp = fopen(argv[i], "r")) == NULL) {
+	       perror(argv[i]);
+	       ret = -1;
+	       continue;
+	  }
+	  if (readstream(fp, argv[i]) < 0)
+	       ret = -1;
+	  fclose(fp);
+     }
+     return ret < 0 ? 1 : 0;
+}
+
+/* [EOF] */
@@ -0,0 +1,63 @@
+/*
+ * gpstat.h - format of the per-generation statistics stream
+ *
+ * The stream starts with a struct gshead, followed by one block per
+ * generation: a struct gsblock, then the columns of its n rows, one
+ * column after another:
+ *	int		ncells[n];
+ *	float		fitness[n];	(sum of distances)
+ *	unsigned char	status[n];	(GS_*)
+ *	int		steps[n];	(total beta steps; -1 = unknown)
+ *	int		peak[n];	(peak #cells; -1 = unknown)
+ * The rows are in ascending order of ncells.  Numbers are in the byte
+ * order of the machine that wrote them; gshead.order tells which.
+ */
+
+#ifndef _GPSTAT_H
+#define _GPSTAT_H
+
+#define GS_MAGIC	"lgpstat1"
+#define GS_BLOCKMAGIC	0x6c677062	/* "lgpb" */
+
+enum {
+     GS_VERSION = 1,
+     GS_ORDER = 0x01020304,
+};
+
+/* status of an individual */
+enum {
+     GS_UNFINISHED = 0,	/* some reduction did not reach normal form */
+     GS_FINISHED = 1,
+     GS_BOUNDED = 2,	/* lost the race; fitness is a lower bound */
+};
+
+struct gshead {
+     char magic[8];
+     int version;
+     int order;
+};
+
+struct gsblock {
+     int magic;
+     int gen;
+     int n;		/* #rows */
+     int ncases;	/* #testcases the fitness is summed over */
+};
+
+/* columns of a block as read by the tools */
+struct gsrows {
+     int *ncells;
+     float *fitness;
+     unsigned char *status;
+     int *steps;
+     int *peak;
+     int max;		/* #elements allocated */
+};
+
+/* gsread.c - reading streams, for the tools */
+int gsreadhead(FILE *, char *);
+int gsreadblock(FILE *, char *, struct gsblock *, struct gsrows *);
+
+#endif /* _GPSTAT_H */
+
+/* [EOF] */
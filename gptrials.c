@@ -0,0 +1,333 @@
+/*
+ * gptrials.c - run multiple GP trials in parallel
+ *
+ * usage: gptrials [-j jobs] [-p] [-t template] [-g gp] [-o summary]
+ *                 <file base name> <seed base#> <#iteration>
+ *
+ * does what try does, with up to jobs trials (default: #CPUs) running
+ * at a time.  trial N runs in its own directory d.<base><N> with the
+ * input file made from the template, so that checkpoint files of the
+ * trials do not collide; its standard output goes to gp.out there.
+ * with -p, each running trial is pinned to a CPU of its own.  when a
+ * trial ends, its statistics are rendered by gpplot (if found next to
+ * gp) and a line is added to the summary (default: standard output):
+ *
+ *	trial seed status wall user sys generations best
+ *
+ * tab-separated; status is the exit status of gp, or -signal; wall,
+ * user and sys are in seconds; generations and best (the best sum of
+ * distances) are from the .sta file.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "gpstat.h"
+
+struct trial {
+     pid_t pid;		/* 0 = slot free */
+     int num;
+     struct timeval start;
+};
+
+static char *filebase, *seedbase;
+static char *template = "template.in";
+static char gppath[1024], plotpath[1024];
+static int pin = 0;
+static int ncpus;
+static FILE *summary;
+
+/*
+ * substitute - copy the template to path, replacing $SEEDBASE,
+ *              $FILEBASE and $TRIAL.  returns 0 if OK.
+ */
+static int
+substitute(char *path, char *trialstr)
+{
+     static struct {
+	  char *name;
+	  char *value;
+     } vars[3];
+     FILE *in, *out;
+     char line[4096], *p;
+     int i, n;
+
+     vars[0].name = "$SEEDBASE";
+     vars[0].value = seedbase;
+     vars[1].name = "$FILEBASE";
+     vars[1].value = filebase;
+     vars[2].name = "$TRIAL";
+     vars[2].value = trialstr;
+
+     if ((in = fopen(template, "r")) == NULL) {
+	  perror(template);
+	  return -1;
+     }
+     if ((out = fopen(path, "w")) == NULL) {
+	  perror(path);
+	  fclose(in);
+	  return -1;
+     }
+     while (fgets(line, sizeof(line), in) != NULL)
+	  for (p = line; *p != '\0'; ) {
+	       for (i = 0; i < 3; i++) {
+		    n = strlen(vars[i].name);
+		    if (strncmp(p, vars[i].name, n) == 0)
+			 break;
+	       }
+	       if (i < 3) {
+		    fputs(vars[i].value, out);
+		    p += n;
+	       } else
+		    putc(*p++, out);
+	  }
+     fclose(in);
+     return fclose(out) == 0 ? 0 : -1;
+}
+
+/*
+ * launch - start trial num in slot (pinned to CPU slot with -p)
+ */
+static pid_t
+launch(int num, int slot)
+{
+     char trialstr[16], dir[1024], input[2100];
+     cpu_set_t cpus;
+     pid_t pid;
+     int fd;
+
+     snprintf(trialstr, sizeof(trialstr), "%03d", num);
+     snprintf(dir, sizeof(dir), "d.%s%s", filebase, trialstr);
+     snprintf(input, sizeof(input), "%s/in.%s%s", dir, filebase, trialstr);
+     if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+	  perror(dir);
+	  return -1;
+     }
+     if (substitute(input, trialstr) < 0)
+	  return -1;
+
+     if ((pid = fork()) < 0) {
+	  perror("fork");
+	  return -1;
+     }
+     if (pid > 0)
+	  return pid;
+
+     /* child */
+     if (chdir(dir) < 0) {
+	  perror(dir);
+	  _exit(127);
+     }
+     if (pin) {
+	  CPU_ZERO(&cpus);
+	  CPU_SET(slot % ncpus, &cpus);
+	  if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+	       perror("sched_setaffinity");
+     }
+     if ((fd = open("gp.out", O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0) {
+	  dup2(fd, 1);
+	  dup2(fd, 2);
+	  close(fd);
+     }
+     fd = open("/dev/null", O_RDONLY);
+     if (fd >= 0) {
+	  dup2(fd, 0);
+	  close(fd);
+     }
+     snprintf(input, sizeof(input), "in.%s%s", filebase, trialstr);
+     execl(gppath, "gp", "-f", input, (char *)NULL);
+     perror(gppath);
+     _exit(127);
+}
+
+/*
+ * result - last generation and best sum of distances in the .sta
+ *          file of a trial.  -1 if not known.
+ */
+static void
+result(char *path, int *gen, double *best)
+{
+     static struct gsrows rows;
+     struct gsblock b;
+     FILE *fp;
+     int i;
+
+     *gen = -1;
+     *best = -1.0;
+     if ((fp = fopen(path, "r")) == NULL)
+	  return;
+     if (gsreadhead(fp, path) == 0)
+	  while (gsreadblock(fp, path, &b, &rows) > 0) {
+	       *gen = b.gen;
+	       for (i = 0; i < b.n; i++)
+		    if (rows.status[i] != GS_BOUNDED &&
+			(*best < 0.0 || rows.fitness[i] < *best))
+			 *best = rows.fitness[i];
+	  }
+     fclose(fp);
+}
+
+/*
+ * finish - the trial in t has ended with status and usage ru
+ */
+static void
+finish(struct trial *t, int status, struct rusage *ru)
+{
+     char trialstr[16], dir[1024], path[2048], cmd[8192];
+     struct timeval now;
+     double wall, best;
+     int code, gen;
+
+     gettimeofday(&now, NULL);
+     wall = (now.tv_sec - t->start.tv_sec) + (now.tv_usec - t->start.tv_usec) / 1e6;
+     if (WIFEXITED(status))
+	  code = WEXITSTATUS(status);
+     else
+	  code = -WTERMSIG(status);
+
+     snprintf(trialstr, sizeof(trialstr), "%03d", t->num);
+     snprintf(dir, sizeof(dir), "d.%s%s", filebase, trialstr);
+     snprintf(path, sizeof(path), "%s/%s%s.sta", dir, filebase, trialstr);
+     result(path, &gen, &best);
+
+     if (code == 0) {
+	  /* as try does */
+	  if (access(plotpath, X_OK) == 0) {
+	       snprintf(cmd, sizeof(cmd), "'%s' -o '%s/%s%s.ps' '%s'",
+			plotpath, dir, filebase, trialstr, path);
+	       if (system(cmd) != 0)
+		    fprintf(stderr, "gptrials: gpplot failed for trial %s\n", trialstr);
+	  }
+	  snprintf(cmd, sizeof(cmd), "rm -f '%s'/gp*.ckp", dir);
+	  if (system(cmd) != 0)
+	       fprintf(stderr, "gptrials: cannot remove checkpoints of trial %s\n", trialstr);
+     }
+
+     fprintf(summary, "%d\t%s%s\t%d\t%.3f\t%.3f\t%.3f\t%d\t%g\n", t->num, seedbase, trialstr,
+	     code, wall,
+	     ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6,
+	     ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6,
+	     gen, best);
+     fflush(summary);
+     t->pid = 0;
+}
+
+static void
+usage(void)
+{
+     fprintf(stderr, "usage: gptrials [-j jobs] [-p] [-t template] [-g gp] [-o summary]\n"
+	     "                <file base name> <seed base#> <#iteration>\n");
+     exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+     struct trial *slots;
+     struct rusage ru;
+     char *gp, *p;
+     int c, i, jobs, numiter, next, running, status;
+     pid_t pid;
+
+     ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+     if (ncpus <= 0)
+	  ncpus = 1;
+     jobs = ncpus;
+     gp = "./gp";
+     summary = stdout;
+     while ((c = getopt(argc, argv, "j:pt:g:o:")) != -1) {
+	  switch (c) {
+	  case 'j':
+	       jobs = atoi(optarg);
+	       break;
+	  case 'p':
+	       pin = 1;
+	       break;
+	  case 't':
+	       template = optarg;
+	       break;
+	  case 'g':
+	       gp = optarg;
+	       break;
+	  case 'o':
+	       if ((summary = fopen(optarg, "w")) == NULL) {
+		    perror(optarg);
+		    exit(1);
+	       }
+	       break;
+	  default:
+	       usage();
+	  }
+     }
+     if (argc - optind != 3 || jobs <= 0)
+	  usage();
+     filebase = argv[optind];
+     seedbase = argv[optind+1];
+     numiter = atoi(argv[optind+2]);
+
+     /* the trials run in their directories */
+     if (realpath(gp, gppath) == NULL) {
+	  perror(gp);
+	  exit(1);
+     }
+     strcpy(plotpath, gppath);
+     if ((p = strrchr(plotpath, '/')) != NULL)
+	  strcpy(p + 1, "gpplot");
+
+     if ((slots = calloc(jobs, sizeof(slots[0]))) == NULL) {
+	  fprintf(stderr, "gptrials: cannot allocate %d slots\n", jobs);
+	  exit(1);
+     }
+     fprintf(summary, "#trial\tseed\tstatus\twall\tuser\tsys\tgenerations\tbest\n");
+     fflush(summary);	/* not to be copied to the children */
+
+     next = 0;
+     running = 0;
+     while (next < numiter || running > 0) {
+	  /* fill the free slots */
+	  for (i = 0; i < jobs && next < numiter; i++) {
+	       if (slots[i].pid != 0)
+		    continue;
+	       gettimeofday(&slots[i].start, NULL);
+	       slots[i].num = next;
+	       if ((pid = launch(next, i)) > 0) {
+		    slots[i].pid = pid;
+		    running++;
+	       } else
+		    fprintf(summary, "%d\t%s%03d\t%d\t0\t0\t0\t-1\t-1\n", next, seedbase, next, 127);
+	       next++;
+	  }
+	  if (running == 0)
+	       continue;
+
+	  if ((pid = wait4(-1, &status, 0, &ru)) < 0) {
+	       if (errno == EINTR)
+		    continue;
+	       perror("wait4");
+	       break;
+	  }
+	  for (i = 0; i < jobs; i++)
+	       if (slots[i].pid == pid) {
+		    finish(&slots[i], status, &ru);
+		    running--;
+		    break;
+	       }
+     }
+
+     if (summary != stdout)
+	  fclose(summary);
+     return 0;
+}
+
+/* [EOF] */
@@ -0,0 +1,89 @@
+/*
+ * gsread.c - read the statistics stream (.sta); shared by the tools.
+ *            the stream may be compressed (see lz.c); one stream is
+ *            read at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpstat.h"
+#include "lz.h"
+
+static struct zstream gz;
+
+static int
+readfull(FILE *fp, void *buf, size_t size, size_t n)
+{
+     return Zread(&gz, buf, size * n) == (int)(size * n);
+}
+
+static void
+enlarge(struct gsrows *r, int n)
+{
+     if (n <= r->max)
+	  return;
+     r->ncells = realloc(r->ncells, n * sizeof(int));
+     r->fitness = realloc(r->fitness, n * sizeof(float));
+     r->status = realloc(r->status, n * sizeof(unsigned char));
+     r->steps = realloc(r->steps, n * sizeof(int));
+     r->peak = realloc(r->peak, n * sizeof(int));
+     if (r->ncells == NULL || r->fitness == NULL || r->status == NULL ||
+	 r->steps == NULL || r->peak == NULL) {
+	  fprintf(stderr, "cannot allocate for %d rows\n", n);
+	  exit(1);
+     }
+     r->max = n;
+}
+
+/*
+ * gsreadhead - read and check the header of a stream.
+ *              returns 0 if OK, -1 if not.
+ */
+int
+gsreadhead(FILE *fp, char *name)
+{
+     struct gshead h;
+
+     Zclose(&gz);
+     Zopenread(&gz, fp);
+     if (!readfull(fp, &h, sizeof(h), 1) ||
+	 memcmp(h.magic, GS_MAGIC, sizeof(h.magic)) != 0) {
+	  fprintf(stderr, "%s: not a statistics stream\n", name);
+	  return -1;
+     }
+     if (h.order != GS_ORDER || h.version != GS_VERSION) {
+	  fprintf(stderr, "%s: version or byte order not supported\n", name);
+	  return -1;
+     }
+     return 0;
+}
+
+/*
+ * gsreadblock - read the next block into *b and *r, enlarging *r
+ *               (zero-filled at first) as needed.
+ *               returns 1 if read, 0 at the end, -1 if broken.
+ */
+int
+gsreadblock(FILE *fp, char *name, struct gsblock *b, struct gsrows *r)
+{
+     if (!readfull(fp, b, sizeof(*b), 1))
+	  return 0;
+     if (b->magic != GS_BLOCKMAGIC || b->n < 0) {
+	  fprintf(stderr, "%s: broken block after generation %d\n", name, b->gen);
+	  return -1;
+     }
+     enlarge(r, b->n);
+     if (!readfull(fp, r->ncells, sizeof(int), b->n) ||
+	 !readfull(fp, r->fitness, sizeof(float), b->n) ||
+	 !readfull(fp, r->status, sizeof(unsigned char), b->n) ||
+	 !readfull(fp, r->steps, sizeof(int), b->n) ||
+	 !readfull(fp, r->peak, sizeof(int), b->n)) {
+	  fprintf(stderr, "%s: truncated at generation %d\n", name, b->gen);
+	  return -1;
+     }
+     return 1;
+}
+
+/* [EOF] */
@@ -100,11 +100,39 @@ enum {
    * maximum tree height.  used for diff'ing
    */
   MAXTREEHEIGHT = 2048,
+  /* maximum #targets for diffn() */
+  MAXDIFFTARGETS = 8,
+  /* initial depth of the stack of cells on the path to a redex */
+  INITPATHSIZE = 256,
+  /* smallest subtree worth memoizing its normal form */
+  MEMOMINCELLS = 8,
+  /* fewest steps worth memoizing; copying the result is not free */
+  MEMOMINSTEPS = 8,
+  /* max #memo entries being recorded at a time, i.e., nested */
+  MAXMEMOREC = 16,
+};
+
+/* base of the level profile digest; odd so that it is invertible mod 2^n */
+#define DIGESTBASE	0x9e3779b97f4a7c15UL
+
+enum {
+  /* why betadiff stopped reducing */
+  BD_GOING = 0,
+  BD_STEPS,	/* maxstep reached */
+  BD_CELLS,	/* maxcells exceeded */
+};
+
+enum {
+  /* for struct lcell.hstate */
+  HS_NONE = 0,	/* no hash here nor anywhere below */
+  HS_STALE,	/* no hash here, but some cells below may have one */
+  HS_VALID,	/* hash here and in all the cells below */
 };
 
 typedef long int Var;		/* variable */
 typedef long int Cellidx;	/* cell pool index */
 typedef long int Lexp;		/* top of lambda expression; actually Cellidx */
+typedef struct lstate *Lstate;	/* engine */
 
 enum {
   CELLIDX_MAX = LONG_MAX,
@@ -128,18 +156,39 @@ struct lcell {
     } ap;
   } d;
   Cellidx nextfree;
-  Var bdist;	/* binding distance; used to calculate differences */
+  /*
+   * annotations of the subtree rooted here.  set when the cell is made
+   * and repaired along the rewrite path, so they are always current.
+   */
+  int size;		/* #cells */
+  int height;		/* #levels; a VAR has 1 */
+  int nabst;		/* #ABST cells */
+  int nredex;		/* #redexes */
+  unsigned long digest;	/* level profile digest: sum of #cells at level i * DIGESTBASE^i; may collide */
+  /*
+   * alpha-invariant structural hash of the subtree, with bound variables
+   * taken as binding distances from the top of the whole lexp.  computed
+   * on demand by hashLexp() and dropped when the cell or its context changes.
+   */
+  int hstate;		/* HS_NONE, HS_STALE or HS_VALID */
+  unsigned long hash;
 };
 
 typedef struct lcell Lcell;
 
-struct velem {
-  Var v;
-  struct velem *next;
+/*
+ * memo of reductions of closed subtrees, keyed by their hash
+ */
+struct memo {
+  Lexp result;		/* normal form, or where maxstep stopped; -1 = empty */
+  unsigned long hash;	/* of the subtree before reduction */
+  int size, height;	/* ditto */
+  unsigned long digest;	/* ditto */
+  int steps;		/* #steps to result */
+  int peak;		/* max #cells of the subtree on the way */
+  int finished;		/* result is in normal form */
 };
 
-typedef struct velem VarList;
-
 /* aliases for simplicity */
 #define Ctype(idx)	(pool[idx].type)
 #define Cvar(idx)	(pool[idx].d.var)
@@ -147,7 +196,13 @@ typedef struct velem VarList;
 #define Cbody(idx)	(pool[idx].d.ab.body)
 #define Cleft(idx)	(pool[idx].d.ap.left)
 #define Cright(idx)	(pool[idx].d.ap.right)
-#define Cbdist(idx)	(pool[idx].bdist)
+#define Csize(idx)	(pool[idx].size)
+#define Cheight(idx)	(pool[idx].height)
+#define Cnabst(idx)	(pool[idx].nabst)
+#define Cnredex(idx)	(pool[idx].nredex)
+#define Cdigest(idx)	(pool[idx].digest)
+#define Chstate(idx)	(pool[idx].hstate)
+#define Chash(idx)	(pool[idx].hash)
 
 /*
  * parser definitions (was in parser.h)
@@ -184,17 +239,29 @@ Lexp Lnewvar(Var);
 Lexp Labst(Var, Lexp);
 Lexp Lappl(Lexp, Lexp);
 Lexp Lcopy(Lexp);
+Lexp Lfromdebruijn(int, int [], Var []);
+void Lbuildbuf(int, int **, Var **);
 void Lfree(Lexp);
 Lexp Lstr2Lexp(char *);
 int LLexp2str(Lexp, char *, int);
+void Lfprint(FILE *, Lexp);
 void Lcanon(Lexp);
 int Leq(Lexp, Lexp);
+unsigned long Lhash(Lexp);
 int Lbeta(Lexp, int, int, int);
+int Lpeakcells(void);
 void Linit(void);
 void LdfsLexp(Lexp, int (*)(Cellidx, int));
 int Ltype(Cellidx);
 int Lcountcells(Lexp);
+int Lcountappl(Lexp);
 void Lepoolinfo(void);
+int Ldiff(Lexp, Lexp);
+void Ldiffn(Lexp, Lexp [], int, int [], int []);
+int Lbetadiff(Lexp, Lexp, int *, int, int, int);
+void Lmemo(int);
+long Lmemodump(unsigned char *, long);
+int Lmemoload(const unsigned char *, long);
 
 /*
  * functions that was in strlexp.c
@@ -229,11 +296,18 @@ static void freecell(Cellidx);
 static void prunecell(Cellidx);
 static Cellidx deepcopy(Cellidx);
 static void copycell(Cellidx, Cellidx);
+static void annotate(Cellidx);
 static void canonbvars(Lexp);
-static int isequalLexp_r(Cellidx, VarList *, Cellidx, VarList *);
+static void unhash(Cellidx);
+static unsigned long hashmix(unsigned long, unsigned long);
+static unsigned long hashLexp_r(Cellidx, int);
+static unsigned long hashLexp(Lexp);
+static int isequalLexp_r(Cellidx, Var [], Cellidx, Var [], int);
 static int isequalLexp(Lexp, Lexp);
 static void dfsLexp_rec(Cellidx, int (*)(Cellidx, int));
 static void dfsLexp(Lexp, int (*)(Cellidx, int));
+static void growbuild(int);
+static Lexp fromdebruijn(int, int [], Var []);
 
 /*
  * functions that was in message.c
@@ -260,7 +334,10 @@ static Lexp alpha(Lexp, Var, Lexp);
 static Var findmaxvar(Lexp);
 static Lexp subst(Lexp, Var, Lexp, Var);
 static int betaat(Cellidx);
+static void pushpath(Cellidx);
+static void repairpath(void);
 static Cellidx canon_findredex(Cellidx);
+static Cellidx head_findredex(Cellidx);
 static Cellidx findredex(Lexp, int);
 static int betastep(Lexp, int);
 static int nbeta(Lexp, int, int, int);
@@ -268,18 +345,32 @@ static int nbeta(Lexp, int, int, int);
 /*
  * newly added
  */
-static int countcells_handler(Cellidx, int);
 static int countcells(Lexp);
 
 /*
  * functions that was in diff.c
  */
-static void calcbdist_r(Cellidx, int);
-static void calcbdist(Cellidx);
-static int diff_r(Lexp, Lexp);
+static int numnodes(Cellidx);
+static Var bdist(Var, Var [], int);
+static int diffleaf(Cellidx, Var [], Cellidx, Var [], int);
+static int diff_r(Cellidx, Cellidx, int);
 static int diff(Lexp, Lexp);
+static int diffn_r(Cellidx, Cellidx [], int, int);
+static void diffn(Lexp, Lexp [], int, int [], int []);
 static int arraynodes_r(Cellidx, int, int [], int);
-static int arraynodes(Cellidx, int [], int);
+static int bdstep(Cellidx, int);
+static int bdbound(Cellidx, Cellidx);
+static int isclosed(Cellidx, int, int);
+static void memoinit(int);
+static int memosplice(Cellidx);
+static int memostart(Cellidx);
+static void memoend(int);
+static int todebruijn(Cellidx, int, Var [], unsigned char *, Var *);
+static long memodump(unsigned char *, long);
+static int memoload(const unsigned char *, long);
+static void bdcompare(Cellidx, Cellidx, int);
+static void betadiff_r(Cellidx, Cellidx, int);
+static int betadiff(Lexp, Lexp, int *, int, int, int);
 
 /*
  * global variables (was in global.c)
@@ -296,9 +387,6 @@ static enum level dlevel[F_NUMFACIL] = {
   L_PRODUCT,	/* F_MISC */
 };
 
-static Lcell *pool;	/* cell pool */
-static Cellidx poolsize = 0;	/* current #cells in the pool */
-
 static char *typename[NOTYPE+1] = {
   "FREE",
   "VAR",
@@ -328,21 +416,126 @@ static char *tokenname[LP_NUMTOK+1] = {
 };
 
 /*
- * variables private to specific facility (have been already "static")
+ * state of an engine.  all the variables that change are gathered in
+ * struct lstate, so that each thread can work on an engine of its own
+ * (see Luse); the macros below keep their names as they were.
  */
 
-/* pool */
-static unsigned long int count_allocated = 0, count_freed = 0;
-static Cellidx freehead;	/* head of the free list */
+/* building from arrays */
+struct buildent {
+  Cellidx cell;
+  int nchild;	/* #children linked so far */
+};
 
-/* parser */
-static char *parser_cur;	/* where lex looks at */
-static enum token parser_next;	/* token got */
-static Var parser_tokdata;	/* token itself; only Var needs this data */
-static int parser_error;
+/* memo entry being recorded */
+struct memoent {
+  Cellidx cell;		/* subtree being reduced */
+  struct memo key;	/* its key, and steps and peak so far */
+};
 
-/* diff calculation */
-static Var boundvars[MAXABSTDEPTH];
+struct lstate {
+  /* pool */
+  Lcell *pool;	/* cell pool */
+  Cellidx poolsize;	/* current #cells in the pool */
+  unsigned long int count_allocated, count_freed;
+  Cellidx freehead;	/* head of the free list */
+
+  /* building from arrays */
+  struct buildent *buildstack;
+  int buildsize;
+  int *buildtypes;	/* arrays to build from, of buildcap cells */
+  Var *buildidx;
+  int buildcap;
+
+  /* lambops */
+  Cellidx *redexpath;	/* ancestors of the redex last found, root first */
+  int pathlen, pathsize;
+  int peakcells;	/* max #cells during the last reduction */
+
+  /* parser */
+  char *parser_cur;	/* where lex looks at */
+  enum token parser_next;	/* token got */
+  Var parser_tokdata;	/* token itself; only Var needs this data */
+  int parser_error;
+
+  /* hashing */
+  Var hashbvs[MAXABSTDEPTH];	/* binding vars on the way down */
+
+  /* diff calculation and equality */
+  Var bvstack1[MAXABSTDEPTH], bvstack2[MAXABSTDEPTH];	/* binding vars on the way down */
+  int levels1[MAXTREEHEIGHT], levels2[MAXTREEHEIGHT];	/* all zero between uses */
+  Var dnbvs[MAXDIFFTARGETS][MAXABSTDEPTH];	/* binding vars of each target for diffn */
+  int dndist[MAXDIFFTARGETS], dnlimit[MAXDIFFTARGETS];
+  int dnlive;	/* #targets not yet over the limit */
+
+  /* reduction along with diff calculation */
+  Lexp bdroot;	/* whole lexp being reduced */
+  int *bdsteps;	/* #steps done so far */
+  int bdmaxstep, bdmaxcells, bdlimit;
+  int bddist;	/* difference so far */
+  int bdstopped;	/* BD_GOING, or why it stopped */
+  int bdskipped;	/* some subtree left unreduced for MAXABSTDEPTH */
+  int bdbase;	/* #ancestors of the current position in redexpath */
+
+  /* memo of normal forms for betadiff */
+  struct memo *memotab;
+  int memosize;	/* #entries; 0 = no memo */
+  struct memoent memorec[MAXMEMOREC];
+  int nmemorec;
+  unsigned long memolookups, memohits;
+};
+
+static struct lstate lstate0;	/* engine of the main thread */
+
+/* engine of the calling thread */
+#ifdef POSIX_MT
+static __thread struct lstate *L = &lstate0;
+#else
+static struct lstate *L = &lstate0;
+#endif
+
+#define pool		(L->pool)
+#define poolsize	(L->poolsize)
+#define count_allocated	(L->count_allocated)
+#define count_freed	(L->count_freed)
+#define freehead	(L->freehead)
+#define buildstack	(L->buildstack)
+#define buildsize	(L->buildsize)
+#define buildtypes	(L->buildtypes)
+#define buildidx	(L->buildidx)
+#define buildcap	(L->buildcap)
+#define redexpath	(L->redexpath)
+#define pathlen		(L->pathlen)
+#define pathsize	(L->pathsize)
+#define peakcells	(L->peakcells)
+#define parser_cur	(L->parser_cur)
+#define parser_next	(L->parser_next)
+#define parser_tokdata	(L->parser_tokdata)
+#define parser_error	(L->parser_error)
+#define hashbvs		(L->hashbvs)
+#define bvstack1	(L->bvstack1)
+#define bvstack2	(L->bvstack2)
+#define levels1		(L->levels1)
+#define levels2		(L->levels2)
+#define dnbvs		(L->dnbvs)
+#define dndist		(L->dndist)
+#define dnlimit		(L->dnlimit)
+#define dnlive		(L->dnlive)
+#define bdroot		(L->bdroot)
+#define bdsteps		(L->bdsteps)
+#define bdmaxstep	(L->bdmaxstep)
+#define bdmaxcells	(L->bdmaxcells)
+#define bdlimit		(L->bdlimit)
+#define bddist		(L->bddist)
+#define bdstopped	(L->bdstopped)
+#define bdskipped	(L->bdskipped)
+#define bdbase		(L->bdbase)
+#define memotab		(L->memotab)
+#define memosize	(L->memosize)
+#define memorec		(L->memorec)
+#define nmemorec	(L->nmemorec)
+#define memolookups	(L->memolookups)
+#define memohits	(L->memohits)
 
 /*
  * user (library) interface (was in ilambda.c)
@@ -352,6 +545,7 @@ Lexp
 Lnewvar(Var v) {
   Cellidx c = newcell(VAR);
   Cvar(c) = v;
+  annotate(c);
   return c;
 }
 
@@ -360,6 +554,9 @@ Labst(Var bv, Lexp body) {
   Cellidx c = newcell(ABST);
   Cbv(c) = bv;
   Cbody(c) = body;
+  annotate(c);
+  /* bv may capture variables that were free in body */
+  unhash(body);
   return c;
 }
 
@@ -368,6 +565,7 @@ Lappl(Lexp left, Lexp right) {
   Cellidx c = newcell(APPL);
   Cleft(c) = left;
   Cright(c) = right;
+  annotate(c);
   return c;
 }
 
@@ -376,6 +574,31 @@ Lcopy(Lexp orig) {
   return deepcopy(orig);
 }
 
+/*
+ * Lfromdebruijn - build a lexp from its n cells in prefix order.
+ *
+ * types[i] is VAR, ABST or APPL.  a VAR refers to the idx[i]-th
+ * enclosing lambda (1 = innermost), or is the free variable idx[i] if
+ * there are not so many.  the binding variable of a lambda is named
+ * after its depth, so the lexp is the same as the one built with
+ * Labst(depth, ...) and Lnewvar(depth - idx + 1).
+ */
+Lexp
+Lfromdebruijn(int n, int types[], Var idx[]) {
+  return fromdebruijn(n, types, idx);
+}
+
+/*
+ * Lbuildbuf - arrays of the engine with room for n cells, to be filled
+ *             for Lfromdebruijn; good until the next call
+ */
+void
+Lbuildbuf(int n, int **types, Var **idx) {
+  growbuild(n);
+  *types = buildtypes;
+  *idx = buildidx;
+}
+
 void
 Lfree(Lexp l) {
   prunecell(l);
@@ -394,6 +617,14 @@ LLexp2str(Lexp l, char *buf, int len) {
   return lexp2str(ci, buf, len);
 }
 
+/*
+ * Lfprint - print Lexp to the stream without going through a buffer
+ */
+void
+Lfprint(FILE *fp, Lexp l) {
+  fprintlexp(fp, l);
+}
+
 void
 Lcanon(Lexp l) {
   /* XXX */
@@ -404,7 +635,14 @@ Lcanon(Lexp l) {
 
 int
 Leq(Lexp l1, Lexp l2) {
-  return isequalLexp(l1, l2);
+  if (hashLexp(l1) != hashLexp(l2))
+    return 0;
+  return isequalLexp(l1, l2);	/* confirm */
+}
+
+unsigned long
+Lhash(Lexp l) {
+  return hashLexp(l);
 }
 
 int
@@ -412,11 +650,67 @@ Lbeta(Lexp l, int strategy, int times, int maxcells) {
   return nbeta(l, strategy, times, maxcells);
 }
 
+/*
+ * Lpeakcells - max #cells the lexp had during the last Lbeta or Lbetadiff
+ */
+int
+Lpeakcells() {
+  return peakcells;
+}
+
 void
 Linit() {
   initpool();
 }
 
+/*
+ * Lnewstate - a new engine, to be Luse'd and Linit'ed by a thread.
+ *             every thread but the main one must use an engine of
+ *             its own before anything else; lexps of an engine are
+ *             meaningless to the others.
+ */
+Lstate
+Lnewstate() {
+  struct lstate *s;
+
+  if ((s = calloc(1, sizeof(*s))) == NULL)
+    fatal("Lnewstate: cannot allocate an engine\n");
+  return s;
+}
+
+/*
+ * Luse - let the calling thread work on engine s; returns the one
+ *        it worked on
+ */
+Lstate
+Luse(Lstate s) {
+  struct lstate *old = L;
+
+  L = s;
+  return old;
+}
+
+/*
+ * Lfreestate - free engine s, which no thread may be working on
+ */
+void
+Lfreestate(Lstate s) {
+  struct lstate *old = L;
+
+  L = s;
+  memoinit(0);
+  free(pool);
+  free(buildstack);
+  free(buildtypes);
+  free(buildidx);
+  free(redexpath);
+  L = old;
+  if (s != &lstate0)
+    free(s);
+  else
+    memset(s, 0, sizeof(*s));
+}
+
 void
 LdfsLexp(Lexp l, int (*func)(Cellidx, int)) {
   dfsLexp(l, func);
@@ -432,6 +726,12 @@ Lcountcells(Lexp l) {
   return countcells(l);
 }
 
+int
+Lcountappl(Lexp l) {
+  /* a binary tree has one more leaf (VAR) than inner nodes (APPL) */
+  return (Csize(l) - Cnabst(l) - 1) / 2;
+}
+
 void
 Lepoolinfo() {
   epoolinfo();
@@ -442,6 +742,65 @@ Ldiff(Lexp l1, Lexp l2) {
   return diff(l1, l2);
 }
 
+/*
+ * Ldiffn - differences between l and each of n targets, in one walk over l.
+ *
+ * if limits[k] >= 0, work on target k stops once its difference exceeds
+ * limits[k], and dists[k] is then only known to be > limits[k].
+ * limits[k] < 0 means no limit.
+ */
+void
+Ldiffn(Lexp l, Lexp targets[], int n, int limits[], int dists[]) {
+  diffn(l, targets, n, limits, dists);
+}
+
+/*
+ * Lbetadiff - reduce l in canonical order only as far as needed to know
+ *             its difference from target, and return the difference.
+ *
+ * *steps counts the beta reductions done; it goes on from its value,
+ * so several calls on the same l can share the budget.  reduction
+ * stops at maxstep steps or maxcells cells like Lbeta (0 = no limit),
+ * and l is compared as it is then.  if limit >= 0, the reduction also
+ * stops once the difference exceeds limit, and the result is then only
+ * known to be > limit.  without a limit, l and the result end up the
+ * same as with Lbeta and Ldiff.
+ */
+int
+Lbetadiff(Lexp l, Lexp target, int *steps, int maxstep, int maxcells, int limit) {
+  return betadiff(l, target, steps, maxstep, maxcells, limit);
+}
+
+/*
+ * Lmemo - let Lbetadiff remember the normal forms of closed subtrees
+ *         in a table of n entries, and reuse them where the same
+ *         subtrees are met again.  0 = no memo.  results, step counts
+ *         and #cells stay the same as without memo.
+ */
+void
+Lmemo(int n) {
+  memoinit(n);
+}
+
+/*
+ * Lmemodump - put the entries of the memo in buf of cap bytes, for a
+ *             checkpoint.  returns the #bytes needed; buf is written
+ *             only if they fit.  buf may be NULL to learn the size.
+ */
+long
+Lmemodump(unsigned char *buf, long cap) {
+  return memodump(buf, cap);
+}
+
+/*
+ * Lmemoload - enter the entries put by Lmemodump in the memo, which
+ *             may be of another size.  returns 0 if OK, -1 if broken.
+ */
+int
+Lmemoload(const unsigned char *buf, long len) {
+  return memoload(buf, len);
+}
+
 /*
  * manages the cell pool (was in pool.c)
  */
@@ -752,6 +1111,7 @@ deepcopy(Cellidx ci) {
     case VAR:
       newci = newcell(VAR);
       Cvar(newci) = Cvar(ci);
+      annotate(newci);
       return newci;
     case ABST:
       newci = newcell(ABST);
@@ -761,6 +1121,7 @@ deepcopy(Cellidx ci) {
        */
       t = deepcopy(Cbody(ci));
       Cbody(newci) = t;
+      annotate(newci);
       return newci;
     case APPL:
       newci = newcell(APPL);
@@ -771,6 +1132,7 @@ deepcopy(Cellidx ci) {
       Cleft(newci) = t;
       t = deepcopy(Cright(ci));
       Cright(newci) = t;
+      annotate(newci);
       return newci;
     default:
       abortwithcore("deepcopy: unknown cell type %s, Cellidx = %ld\n", Ctype(ci), ci);
@@ -787,6 +1149,46 @@ copycell(Cellidx src, Cellidx dst) {
   bcopy(&pool[src], &pool[dst], sizeof(pool[dst]));
 }
 
+/*
+ * annotate - set subtree annotations of a cell from those of its children
+ */
+static void
+annotate(Cellidx ci) {
+  Cellidx b, l, r;
+
+  switch (Ctype(ci)) {
+    case VAR:
+      Csize(ci) = 1;
+      Cheight(ci) = 1;
+      Cnabst(ci) = 0;
+      Cnredex(ci) = 0;
+      Cdigest(ci) = 1;
+      Chstate(ci) = HS_NONE;
+      return;
+    case ABST:
+      b = Cbody(ci);
+      Csize(ci) = 1 + Csize(b);
+      Cheight(ci) = 1 + Cheight(b);
+      Cnabst(ci) = 1 + Cnabst(b);
+      Cnredex(ci) = Cnredex(b);
+      Cdigest(ci) = 1 + DIGESTBASE * Cdigest(b);
+      Chstate(ci) = (Chstate(b) == HS_NONE) ? HS_NONE : HS_STALE;
+      return;
+    case APPL:
+      l = Cleft(ci);
+      r = Cright(ci);
+      Csize(ci) = 1 + Csize(l) + Csize(r);
+      Cheight(ci) = 1 + max(Cheight(l), Cheight(r));
+      Cnabst(ci) = Cnabst(l) + Cnabst(r);
+      Cnredex(ci) = Cnredex(l) + Cnredex(r) + (Ctype(l) == ABST);
+      Cdigest(ci) = 1 + DIGESTBASE * (Cdigest(l) + Cdigest(r));
+      Chstate(ci) = (Chstate(l) == HS_NONE && Chstate(r) == HS_NONE) ? HS_NONE : HS_STALE;
+      return;
+    default:
+      abortwithcore("annotate: unknown cell type %d, Cellidx = %ld\n", Ctype(ci), ci);
+  }
+}
+
 /*
  * canonbvars - canonicalize binding variables' ids
  */
@@ -851,64 +1253,127 @@ canonbvars(Lexp l) {
   return;
 }
 
+/*
+ * unhash - drop the hashes in the subtree
+ */
+static void
+unhash(Cellidx ci) {
+  switch (Chstate(ci)) {
+    case HS_NONE:
+      return;
+    default:
+      Chstate(ci) = HS_NONE;
+      switch (Ctype(ci)) {
+	case ABST:
+	  unhash(Cbody(ci));
+	  return;
+	case APPL:
+	  unhash(Cleft(ci));
+	  unhash(Cright(ci));
+	  return;
+      }
+      return;
+  }
+}
+
+/*
+ * hashLexp - alpha-invariant structural hash of a whole lexp
+ *
+ * binding variable names do not take part; a bound variable counts as
+ * its binding distance, a free one as its name.  the hashes are kept in
+ * the cells and only the cells changed since the last call are visited.
+ * l must be a whole lexp, not a part of another one.
+ */
+static unsigned long
+hashmix(unsigned long h, unsigned long v) {
+  h ^= v + 0x9e3779b97f4a7c15UL + (h << 6) + (h >> 2);
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  return h;
+}
+
+static unsigned long
+hashLexp_r(Cellidx ci, int depth) {
+  Var w;
+  unsigned long h;
+
+  if (Chstate(ci) == HS_VALID)
+    return Chash(ci);
+
+  switch (Ctype(ci)) {
+    case VAR:
+      w = bdist(Cvar(ci), hashbvs, min(depth, MAXABSTDEPTH));
+      if (w > 0)
+	h = hashmix(VAR, w);
+      else
+	h = hashmix(FREE, Cvar(ci));
+      break;
+    case ABST:
+      if (depth < MAXABSTDEPTH)
+	hashbvs[depth] = Cbv(ci);
+      else
+	msg_warning(F_POOL, "hashLexp_r: MAXABSTDEPTH reached; binding of %ld ignored\n", Cbv(ci));
+      h = hashmix(ABST, hashLexp_r(Cbody(ci), depth + 1));
+      break;
+    case APPL:
+      h = hashmix(APPL, hashLexp_r(Cleft(ci), depth));
+      h = hashmix(h, hashLexp_r(Cright(ci), depth));
+      break;
+    default:
+      abortwithcore("hashLexp_r: specified non-Lexp or incomplete Lexp: type %d\n", Ctype(ci));
+      /*NOTREACHED*/
+      return 0;
+  }
+  Chash(ci) = h;
+  Chstate(ci) = HS_VALID;
+  return h;
+}
+
+static unsigned long
+hashLexp(Lexp l) {
+  return hashLexp_r(l, 0);
+}
+
+/*
+ * isequalLexp - alpha equivalence
+ *
+ * the binding variables above c1 and c2 are in bvs1[] and bvs2[] up to
+ * depth; those below are pushed there on the way down.
+ */
 static int
-isequalLexp_r(Cellidx c1, VarList *bv1, Cellidx c2, VarList *bv2) {
-  VarList *p1, *p2;
-  Var v1, v2;
-  int res;
+isequalLexp_r(Cellidx c1, Var bvs1[], Cellidx c2, Var bvs2[], int depth) {
+  Var w1, w2;
 
   if (Ctype(c1) != Ctype(c2))
     return 0;
   if (Ctype(c1) == APPL)
-    return isequalLexp_r(Cleft(c1), bv1, Cleft(c2), bv2) &&
-           isequalLexp_r(Cright(c1), bv1, Cright(c2), bv2);
+    return isequalLexp_r(Cleft(c1), bvs1, Cleft(c2), bvs2, depth) &&
+           isequalLexp_r(Cright(c1), bvs1, Cright(c2), bvs2, depth);
   if (Ctype(c1) == ABST) {
-    p1 = emalloc(sizeof(VarList));
-    p1->v = Cbv(c1);
-    p1->next = bv1;
-    p2 = emalloc(sizeof(VarList));
-    p2->v = Cbv(c2);
-    p2->next = bv2;
-    res = isequalLexp_r(Cbody(c1), p1, Cbody(c2), p2);
-    free(p1);
-    free(p2);
-    return res;
+    if (depth >= MAXABSTDEPTH) {
+      msg_warning(F_POOL, "isequalLexp_r: MAXABSTDEPTH reached; regarding as different\n");
+      return 0;
+    }
+    bvs1[depth] = Cbv(c1);
+    bvs2[depth] = Cbv(c2);
+    return isequalLexp_r(Cbody(c1), bvs1, Cbody(c2), bvs2, depth + 1);
   }
   if (Ctype(c1) != VAR) {
     msg_warning(F_POOL, "isequalLexp_r: comparing bad type (%d)\n", Ctype(c1));
     return 0;	/* XXX: should abort? */
   }
-  /* comparing variables */
-  v1 = Cvar(c1);
-  v2 = Cvar(c2);
-  /* are those bound variables? */
-  for (p1 = bv1, p2 = bv2; p1 != NULL && p2 != NULL; p1 = p1->next, p2 = p2->next) {
-    if (p1->v == v1) {
-      if (p2->v == v2) {
-	/* same bound variable */
-	return 1;
-      } else {
-	/* v1 is bound but v2 is not the same bound var */
-	return 0;
-      }
-    } else if (p2->v == v2) {
-      /* v2 is bound here but v1 not */
-      return 0;
-    } else {
-      /* both not bound; continue */
-      ;
-    }
-  }
+  /* comparing variables; bound ones must refer to the same lambda */
+  w1 = bdist(Cvar(c1), bvs1, depth);
+  w2 = bdist(Cvar(c2), bvs2, depth);
+  if (w1 > 0 || w2 > 0)
+    return w1 == w2;
   /* both are free variables */
-  if (v1 == v2)
-    return 1;
-  else
-    return 0;
+  return Cvar(c1) == Cvar(c2);
 }
 
 int
 isequalLexp(Lexp l1, Lexp l2) {	
-  return isequalLexp_r(l1, NULL, l2, NULL);
+  return isequalLexp_r(l1, bvstack1, l2, bvstack2, 0);
 }
 
 /*
@@ -956,6 +1421,108 @@ dfsLexp(Lexp l, int (*func)(Cellidx, int)) {
   dfsLexp_rec(rootci, func);
 }
 
+/*
+ * growbuild - make buildtypes[] and buildidx[] hold at least n cells
+ */
+static void
+growbuild(int n) {
+  int *newt;
+  Var *newi;
+
+  if (n <= buildcap)
+    return;
+  if (buildcap < INITPATHSIZE)
+    buildcap = INITPATHSIZE;
+  while (buildcap < n)
+    buildcap *= 2;
+  newt = realloc(buildtypes, buildcap * sizeof(buildtypes[0]));
+  if (newt != NULL)
+    buildtypes = newt;
+  newi = realloc(buildidx, buildcap * sizeof(buildidx[0]));
+  if (newi != NULL)
+    buildidx = newi;
+  if (newt == NULL || newi == NULL)
+    fatal("growbuild: cannot enlarge arrays to %d\n", buildcap);
+}
+
+/*
+ * fromdebruijn - build a lexp top down in one pass over prefix arrays
+ *
+ * each cell is linked to its parent as soon as it is made; the open
+ * ancestors are kept on buildstack, and are annotated when their last
+ * child is complete.
+ */
+static Lexp
+fromdebruijn(int n, int types[], Var idx[]) {
+  struct buildent *newp;
+  Cellidx c, root, top;
+  int i, sp;
+  Var depth;
+
+  root = -1;
+  sp = 0;
+  depth = 0;
+  for (i = 0; i < n; i++) {
+    if (i > 0 && sp == 0)
+      fatal("fromdebruijn: extra cells after the lexp at %d\n", i);
+    c = newcell(types[i]);
+    switch (types[i]) {
+      case VAR:
+	Cvar(c) = (0 < idx[i] && idx[i] <= depth) ? depth - idx[i] + 1 : idx[i];
+	annotate(c);
+	break;
+      case ABST:
+	Cbv(c) = ++depth;
+	break;
+      case APPL:
+	break;
+      default:
+	fatal("fromdebruijn: unknown cell type %d at %d\n", types[i], i);
+    }
+
+    /* link to the parent */
+    if (sp == 0)
+      root = c;
+    else {
+      top = buildstack[sp-1].cell;
+      if (Ctype(top) == ABST)
+	Cbody(top) = c;
+      else if (buildstack[sp-1].nchild == 0)
+	Cleft(top) = c;
+      else
+	Cright(top) = c;
+      buildstack[sp-1].nchild++;
+    }
+
+    if (types[i] != VAR) {
+      if (sp >= buildsize) {
+	buildsize = (buildsize > 0) ? buildsize * 2 : INITPATHSIZE;
+	if ((newp = realloc(buildstack, buildsize * sizeof(buildstack[0]))) == NULL)
+	  fatal("fromdebruijn: cannot enlarge stack to %d\n", buildsize);
+	buildstack = newp;
+      }
+      buildstack[sp].cell = c;
+      buildstack[sp].nchild = 0;
+      sp++;
+      continue;
+    }
+
+    /* close the ancestors that are now complete */
+    while (sp > 0) {
+      top = buildstack[sp-1].cell;
+      if (buildstack[sp-1].nchild < (Ctype(top) == ABST ? 1 : 2))
+	break;
+      annotate(top);
+      if (Ctype(top) == ABST)
+	depth--;
+      sp--;
+    }
+  }
+  if (sp > 0 || root < 0)
+    fatal("fromdebruijn: lexp incomplete after %d cells\n", n);
+  return root;
+}
+
 /*
  * lambda expression operations (interface) (was in lambops.c)
  */
@@ -985,6 +1552,7 @@ alpha(Lexp m, Var x, Lexp n) {
       cright = alpha(Cright(ci), x, n);
       Cleft(ci) = cleft;
       Cright(ci) = cright;
+      annotate(ci);
       return ci;
     }
     case ABST: {
@@ -995,6 +1563,7 @@ alpha(Lexp m, Var x, Lexp n) {
       else {
 	body = alpha(Cbody(ci), x, n);
 	Cbody(ci) = body;
+	annotate(ci);
 	return ci;
       }
     }
@@ -1054,8 +1623,11 @@ subst(Lexp m, Var x, Lexp n, Var maxvar) {
 	if (Cvar(m) == x) {
 	  freecell(m);
 	  lret = deepcopy(n);
-	} else
+	} else {
+	  /* a lambda above is going away */
+	  Chstate(m) = HS_NONE;
 	  lret = m;
+	}
       }
       break;
     case APPL: {
@@ -1065,6 +1637,7 @@ subst(Lexp m, Var x, Lexp n, Var maxvar) {
 	cright = subst(Cright(m), x, n, maxvar);
 	Cleft(m) = cleft;
 	Cright(m) = cright;
+	annotate(m);
 	lret = m;
       }
       break;
@@ -1089,6 +1662,7 @@ subst(Lexp m, Var x, Lexp n, Var maxvar) {
 	newbody = subst(body, x, n, maxvar);
 	Cbv(m) = newbv;
 	Cbody(m) = newbody;
+	annotate(m);
 	lret = m;
       }
       break;
@@ -1137,10 +1711,40 @@ betaat(Cellidx redex) {
   return 1;
 }
 
+/*
+ * pushpath - push a cell on the path to the redex
+ */
+static void
+pushpath(Cellidx c) {
+  Cellidx *newp;
+
+  if (pathlen >= pathsize) {
+    pathsize = (pathsize > 0) ? pathsize * 2 : INITPATHSIZE;
+    if ((newp = realloc(redexpath, pathsize * sizeof(redexpath[0]))) == NULL)
+      fatal("pushpath: cannot enlarge path to %d cells\n", pathsize);
+    redexpath = newp;
+  }
+  redexpath[pathlen++] = c;
+}
+
+/*
+ * repairpath - update annotations of the ancestors of the reduced redex,
+ *              from the bottom up
+ */
+static void
+repairpath() {
+  int i;
+
+  for (i = pathlen - 1; i >= 0; i--)
+    annotate(redexpath[i]);
+  pathlen = 0;
+}
+
 /*
  * canon_findredex - find a redex for canonical reduction
  *
- * returns Cellidx when found, -1 if not found
+ * returns Cellidx when found, -1 if not found.
+ * the ancestors of the redex are left in redexpath.
  */
 static Cellidx
 canon_findredex(Cellidx c) {
@@ -1149,8 +1753,15 @@ canon_findredex(Cellidx c) {
   switch (Ctype(c)) {
     case VAR:
       return -1;
-    case ABST:
-      return canon_findredex(Cbody(c));
+    case ABST: {
+	Cellidx redex;
+
+	pushpath(c);
+	if ((redex = canon_findredex(Cbody(c))) >= 0)
+	  return redex;
+	pathlen--;
+	return -1;
+      }
     case APPL: {
 	Cellidx left, right, redex;
 
@@ -1162,13 +1773,17 @@ canon_findredex(Cellidx c) {
 	  return c;
 	}
 
+	pushpath(c);
 	/* search in leftmost manner (and outermost = topdown recursive) */
 	if ((redex = canon_findredex(left)) >= 0) {
 	  /* found in left */
 	  return redex;
 	}
 	/* not found; try right */
-	return canon_findredex(right);
+	if ((redex = canon_findredex(right)) >= 0)
+	  return redex;
+	pathlen--;
+	return -1;
       }
     default:
       /* assert prevents control coming here */
@@ -1177,6 +1792,35 @@ canon_findredex(Cellidx c) {
   }
 }
 
+/*
+ * head_findredex - find the head redex, which is the one canonical
+ *                  reduction takes first unless c is in head normal form
+ *
+ * returns Cellidx when found, -1 if c is in head normal form.
+ * the ancestors of the redex are left in redexpath.
+ */
+static Cellidx
+head_findredex(Cellidx c) {
+  for (;;) {
+    switch (Ctype(c)) {
+      case VAR:
+	return -1;
+      case ABST:
+	pushpath(c);
+	c = Cbody(c);
+	break;
+      case APPL:
+	if (Ctype(Cleft(c)) == ABST)
+	  return c;
+	pushpath(c);
+	c = Cleft(c);
+	break;
+      default:
+	fatal("head_findredex: unexpected cell type %d\n", Ctype(c));
+    }
+  }
+}
+
 /*
  * findredex - find a redex according to the specified strategy
  *
@@ -1194,6 +1838,7 @@ findredex(Lexp l, int strategy) {
       }
       /* FALLTHROUGH */
     case CANONICAL:
+      pathlen = 0;
       return canon_findredex(l);
     default:
       fatal("findredex: unknown strategy %d\n", strategy);
@@ -1225,6 +1870,9 @@ betastep(Lexp l, int strategy) {
 
   assert(reduced);	/* must be reduced because findredex must have found a redex */
 
+  /* the redex changed its size; so did its ancestors */
+  repairpath();
+
   /* now 'redex' points reduced expression */
   /* l points 'redex' so nothing has to be done to link them */
   return 1;
@@ -1242,12 +1890,14 @@ static int
 nbeta(Lexp l, int strategy, int times, int maxcells) {
   int i;
 
+  peakcells = countcells(l);
   if (times > 0) {
     for (i = 0; i < times; i++) {
       if (maxcells > 0 && countcells(l) > maxcells)
 	break;
       if (!betastep(l, strategy))
 	break;
+      peakcells = max(peakcells, countcells(l));
     }
   } else {
     for (i = 0; ; i++) {
@@ -1255,6 +1905,7 @@ nbeta(Lexp l, int strategy, int times, int maxcells) {
 	break;
       if (!betastep(l, strategy))
 	break;
+      peakcells = max(peakcells, countcells(l));
     }
   }
   if (deblev(L_DEBUG, F_LAMBOPS)) {
@@ -1267,22 +1918,9 @@ nbeta(Lexp l, int strategy, int times, int maxcells) {
 /*
  * countcells - count #cells that the lexp possesses
  */
-
-static int ncells;
-
-static int
-countcells_handler(Cellidx ci, int descending) {
-  if (!descending)
-    return 1;	/* ignore; carry on */
-  ncells++;
-  return 1;	/* go deeper */
-}
-
 static int
 countcells(Lexp l) {
-  ncells = 0;
-  dfsLexp(l, countcells_handler);
-  return ncells;
+  return Csize(l);
 }
 
 /*
@@ -1442,6 +2080,7 @@ do_lexp() {
       var = parser_tokdata;
       c = newcell(VAR);
       Cvar(c) = var;
+      annotate(c);
       msg_debug(F_PARSER, "allocated var %ld\n", var);
       return c;
     }
@@ -1501,6 +2140,8 @@ do_abst() {
   c = newcell(ABST);
   Cbv(c) = bv;
   Cbody(c) = body;
+  if (!parser_error)
+    annotate(c);
 
   getnext();	/* skip rparen */
   if (parser_next != LP_RPAREN) {
@@ -1522,6 +2163,8 @@ do_appl() {
   c = newcell(APPL);
   Cleft(c) = left;
   Cright(c) = right;
+  if (!parser_error)
+    annotate(c);
 
   getnext();	/* skip rparen */
   if (parser_next != LP_RPAREN) {
@@ -1636,7 +2279,7 @@ proceedwith(char *buf, char *str, int bytesleft) {
 static int
 lexp2str(Cellidx ci, char *buf, int len) {
   int proceed, n;
-  static char tmp[MISCSTRBUFLEN];
+  char tmp[64];
   int shouldbe;
   
   msg_debug(F_STRLEXP, "lexp2str: called for type %s with len = %d\n", typename[Ctype(ci)], len);
@@ -1774,67 +2417,38 @@ msg_generic(FILE *fp, enum facility f, enum level l, char *fmt, ...) {
  */
 static int
 numnodes(Cellidx ci) {
-  return countcells(ci);
+  return Csize(ci);
 }
 
 /*
- * calcbdist - calculate binding distance for each variable
+ * bdist - binding distance of variable v seen under the binding variables
+ *         bvs[0..depth-1].  > 0 if bound, < 0 if free (-(depth + 1), to reserve 0)
  */
-static void
-calcbdist_r(Cellidx ci, int depth) {
+static Var
+bdist(Var v, Var bvs[], int depth) {
   int i;
 
-  switch (Ctype(ci)) {
-    case VAR:
-      /* search the binding lambda */
-      for (i = depth - 1; i >= 0; i--)
-	if (Cvar(ci) == boundvars[i])
-	  break;
-      if (i < 0)
-	/* free variable */
-	Cbdist(ci) = -(depth + 1);	/* +1 to reserve 0 */
-      else {
-	/* bound variable */
-	Cbdist(ci) = depth - i;
-      }
-      return;
-    case ABST:
-      if (depth < MAXABSTDEPTH) {
-	boundvars[depth] = Cbv(ci);
-	calcbdist_r(Cbody(ci), depth + 1);
-      } else {
-	msg_warning(F_MISC, "calcbdist: MAXABSTDEPTH reached; ignoring the subtree\n");
-      }
-      return;
-    case APPL:
-      calcbdist_r(Cleft(ci), depth);
-      calcbdist_r(Cright(ci), depth);
-      return;
-    default:
-      fatal("calcbdist: invalid cell type %d\n", Ctype(ci));
-      /*NOTREACHED*/
-  }
-}
-
-static void
-calcbdist(Lexp l) {
-  calcbdist_r(l, 0);
+  /* search the binding lambda */
+  for (i = depth - 1; i >= 0; i--)
+    if (v == bvs[i])
+      return depth - i;
+  return -(depth + 1);
 }
 
 /*
- * diff - returns difference between two lexps
+ * diffleaf - difference between two cells where the walk stops,
+ *            i.e., both are VARs or they are of different types.
+ *            bvs1 and bvs2 hold the binding variables above them.
  */
-
 static int
-diff_r(Cellidx c1, Cellidx c2) {
+diffleaf(Cellidx c1, Var bvs1[], Cellidx c2, Var bvs2[], int depth) {
   int i;
-  int w1, w2, dif;
-  int a1[MAXTREEHEIGHT], a2[MAXTREEHEIGHT];
-  int lev1, lev2, bot;
+  Var w1, w2;
+  int dif, lev1, lev2, bot;
 
   if (Ctype(c1) == VAR && Ctype(c2) == VAR) {
-    w1 = Cbdist(c1);
-    w2 = Cbdist(c2);
+    w1 = bdist(Cvar(c1), bvs1, depth);
+    w2 = bdist(Cvar(c2), bvs2, depth);
     if (w1 > 0 && w2 > 0) {
       /* both bound; return difference */
       return DIST(w1, w2);
@@ -1848,27 +2462,61 @@ diff_r(Cellidx c1, Cellidx c2) {
       /* both free */
       return DIST(Cvar(c1), Cvar(c2));
     }
-  } else if (Ctype(c1) == VAR && Ctype(c2) == ABST) {
-    return numnodes(c2);
-  } else if (Ctype(c1) == ABST && Ctype(c2) == VAR) {
-    return numnodes(c1);
-  } else if (Ctype(c1) == VAR && Ctype(c2) == APPL) {
+  } else if (Ctype(c1) == VAR && (Ctype(c2) == ABST || Ctype(c2) == APPL)) {
     return numnodes(c2);
-  } else if (Ctype(c1) == APPL && Ctype(c2) == VAR) {
+  } else if ((Ctype(c1) == ABST || Ctype(c1) == APPL) && Ctype(c2) == VAR) {
     return numnodes(c1);
-  } else if (Ctype(c1) == ABST && Ctype(c2) == ABST) {
-    return diff_r(Cbody(c1), Cbody(c2));
   } else if ((Ctype(c1) == ABST && Ctype(c2) == APPL) ||
              (Ctype(c1) == APPL && Ctype(c2) == ABST)) {
-    lev1 = arraynodes(c1, a1, MAXTREEHEIGHT);
-    lev2 = arraynodes(c2, a2, MAXTREEHEIGHT);
+    /*
+     * no shortcut on equal digests: different level profiles can
+     * have the same digest, so only the profiles themselves tell.
+     * equal ones come to 2 * height below.
+     */
+    lev1 = arraynodes_r(c1, 0, levels1, MAXTREEHEIGHT);
+    lev2 = arraynodes_r(c2, 0, levels2, MAXTREEHEIGHT);
     bot = max(lev1, lev2);
     dif = 0;
-    for (i = 0; i < bot; i++)
-      dif += 2 + DIST(a1[i], a2[i]);
+    for (i = 0; i < bot; i++) {
+      dif += 2 + DIST(levels1[i], levels2[i]);
+      levels1[i] = levels2[i] = 0;	/* leave them cleared for the next use */
+    }
     return dif;
-  } else if (Ctype(c1) == APPL && Ctype(c2) == APPL) {
-    return diff_r(Cleft(c1), Cleft(c2)) + diff_r(Cright(c1), Cright(c2));
+  }
+  fatal("diffleaf: unexpected cell type %d and %d\n", Ctype(c1), Ctype(c2));
+  /*NOTREACHED*/
+  return 0;
+}
+
+/*
+ * diff - returns difference between two lexps
+ *
+ * Both lexps are walked together in one pass.  Binding variables met on
+ * the way down are pushed on bvstack1/bvstack2, so nothing is written to
+ * the pool.  The walk only descends while the shapes match, hence c1 and
+ * c2 are always at the same depth.  Subtrees with the same hash are
+ * likely identical up to the names of the binding variables; as a
+ * collision would change the distance, that is confirmed before they
+ * are skipped.
+ */
+
+static int
+diff_r(Cellidx c1, Cellidx c2, int depth) {
+  if (Chash(c1) == Chash(c2) && isequalLexp_r(c1, bvstack1, c2, bvstack2, depth))
+    return 0;
+
+  if (Ctype(c1) != Ctype(c2) || Ctype(c1) == VAR) {
+    return diffleaf(c1, bvstack1, c2, bvstack2, depth);
+  } else if (Ctype(c1) == ABST) {
+    if (depth >= MAXABSTDEPTH) {
+      msg_warning(F_MISC, "diff_r: MAXABSTDEPTH reached; ignoring the subtree\n");
+      return 0;
+    }
+    bvstack1[depth] = Cbv(c1);
+    bvstack2[depth] = Cbv(c2);
+    return diff_r(Cbody(c1), Cbody(c2), depth + 1);
+  } else if (Ctype(c1) == APPL) {
+    return diff_r(Cleft(c1), Cleft(c2), depth) + diff_r(Cright(c1), Cright(c2), depth);
   } else {
     fatal("diff_r: unexpected cell type %d and %d\n", Ctype(c1), Ctype(c2));
   }
@@ -1881,19 +2529,533 @@ static int
 diff(Lexp l1, Lexp l2) {
   int d;
 
-  char s1[4096], s2[4096];
-  calcbdist(l1);
-  calcbdist(l2);
-  lexp2str(l1, s1, sizeof(s1));
-  lexp2str(l2, s2, sizeof(s2));
-  d = diff_r(l1, l2);
-  /* printf("|%s - %s| = %d\n", s1, s2, d); */
+  /* diff_r relies on the hashes of all the cells */
+  hashLexp(l1);
+  hashLexp(l2);
+  d = diff_r(l1, l2, 0);
+  if (deblev(L_DEBUG, F_MISC)) {
+    msg_debug(F_MISC, "diff: |");
+    fprintlexp_n(stderr, l1);
+    msg_debug(F_MISC, " - ");
+    fprintlexp_n(stderr, l2);
+    msg_debug(F_MISC, "| = %d\n", d);
+  }
   return d;
 }
 
 /*
- * arraynodes - make array of the number of nodes at each level.
- *              returns deepest level reached.
+ * diffn - differences between one lexp and several targets
+ *
+ * l is walked once; each target follows the walk while its shape
+ * matches, and gets its share of the difference where it stops.
+ * A target whose difference has gone over its limit (>= 0) is dropped,
+ * and the walk ends when every target is settled.
+ */
+
+static int
+diffn_r(Cellidx c1, Cellidx c2[], int n, int depth) {
+  Cellidx sub[MAXDIFFTARGETS], sub2[MAXDIFFTARGETS];
+  int k, nsub;
+
+  nsub = 0;
+  for (k = 0; k < n; k++) {
+    if (c2[k] < 0 || (dnlimit[k] >= 0 && dndist[k] > dnlimit[k]) ||
+        (Chash(c1) == Chash(c2[k]) &&
+	 isequalLexp_r(c1, bvstack1, c2[k], dnbvs[k], depth))) {
+      /* settled, over the limit, or nothing more to add */
+      sub[k] = -1;
+    } else if (Ctype(c1) != Ctype(c2[k]) || Ctype(c1) == VAR) {
+      dndist[k] += diffleaf(c1, bvstack1, c2[k], dnbvs[k], depth);
+      if (dnlimit[k] >= 0 && dndist[k] > dnlimit[k])
+	dnlive--;
+      sub[k] = -1;
+    } else {
+      sub[k] = c2[k];
+      nsub++;
+    }
+  }
+  if (nsub == 0)
+    return dnlive;
+
+  switch (Ctype(c1)) {
+    case ABST:
+      if (depth >= MAXABSTDEPTH) {
+	msg_warning(F_MISC, "diffn_r: MAXABSTDEPTH reached; ignoring the subtree\n");
+	return dnlive;
+      }
+      bvstack1[depth] = Cbv(c1);
+      for (k = 0; k < n; k++)
+	if (sub[k] >= 0) {
+	  dnbvs[k][depth] = Cbv(sub[k]);
+	  sub[k] = Cbody(sub[k]);
+	}
+      return diffn_r(Cbody(c1), sub, n, depth + 1);
+    case APPL:
+      for (k = 0; k < n; k++) {
+	sub2[k] = (sub[k] >= 0) ? Cright(sub[k]) : -1;
+	sub[k] = (sub[k] >= 0) ? Cleft(sub[k]) : -1;
+      }
+      if (diffn_r(Cleft(c1), sub, n, depth) == 0)
+	return 0;
+      return diffn_r(Cright(c1), sub2, n, depth);
+    default:
+      fatal("diffn_r: unexpected cell type %d\n", Ctype(c1));
+  }
+  /*NOTREACHED*/
+  return dnlive;
+}
+
+static void
+diffn(Lexp l, Lexp targets[], int n, int limits[], int dists[]) {
+  Cellidx c2[MAXDIFFTARGETS];
+  int k;
+
+  if (n > MAXDIFFTARGETS)
+    fatal("diffn: too many targets (%d > %d)\n", n, MAXDIFFTARGETS);
+
+  hashLexp(l);
+  dnlive = n;
+  for (k = 0; k < n; k++) {
+    hashLexp(targets[k]);
+    c2[k] = targets[k];
+    dndist[k] = 0;
+    dnlimit[k] = limits[k];
+  }
+  (void)diffn_r(l, c2, n, 0);
+  for (k = 0; k < n; k++)
+    dists[k] = dndist[k];
+}
+
+/*
+ * betadiff - reduce a lexp and take its difference from a target together
+ *
+ * Canonical reduction brings a lexp to head normal form
+ * (Lx1...Lxn. h M1 ... Mk) first, and then reduces M1, ..., Mk in this
+ * order in the same way.  So the lexp is reduced position by position,
+ * and compared with the target as soon as a position is in head normal
+ * form; the part already compared never changes again.  Where the shapes
+ * differ, diffleaf needs the whole subtree, which is then reduced to
+ * normal form unless a lower bound of the difference is already over
+ * the limit.  The ancestors of the current position are kept at the
+ * bottom of redexpath, so that the size of the whole lexp is repaired
+ * with each reduction for the maxcells check.
+ */
+
+/*
+ * bdstep - one beta reduction in the subtree c, at its head if head.
+ *          returns 0 if there is no such redex or the budget is used up.
+ */
+static int
+bdstep(Cellidx c, int head) {
+  Cellidx redex;
+
+  int i;
+
+  if (bdstopped)
+    return 0;
+  if (bdmaxstep > 0 && *bdsteps >= bdmaxstep) {
+    bdstopped = BD_STEPS;
+    return 0;
+  }
+  if (bdmaxcells > 0 && Csize(bdroot) > bdmaxcells) {
+    bdstopped = BD_CELLS;
+    return 0;
+  }
+  pathlen = bdbase;
+  redex = head ? head_findredex(c) : canon_findredex(c);
+  if (redex < 0)
+    return 0;
+  betaat(redex);
+  repairpath();
+  (*bdsteps)++;
+  peakcells = max(peakcells, Csize(bdroot));
+  for (i = 0; i < nmemorec; i++)
+    memorec[i].key.peak = max(memorec[i].key.peak, Csize(memorec[i].cell));
+  return 1;
+}
+
+/*
+ * bdbound - lower bound of diffleaf between the normal form of c, which
+ *           is in head normal form and not a VAR, and t of another type
+ */
+static int
+bdbound(Cellidx c, Cellidx t) {
+  int n, k;
+
+  /* the spine Lx1...Lxn. h M1 ... Mk stays in the normal form */
+  for (n = 0; Ctype(c) == ABST; n++)
+    c = Cbody(c);
+  for (k = 0; Ctype(c) == APPL; k++)
+    c = Cleft(c);
+  if (Ctype(t) == VAR)
+    return n + 2 * k + 1;	/* each Mi has a cell at least */
+  /* at least 2 for each level */
+  return 2 * min(max(Cheight(t), n + k + 1), MAXTREEHEIGHT);
+}
+
+/*
+ * isclosed - whether no variable in c is bound by bvstack1[0..top-1],
+ *            the binding variables above c.  c is at depth (>= top).
+ */
+static int
+isclosed(Cellidx c, int top, int depth) {
+  switch (Ctype(c)) {
+    case VAR:
+      return bdist(Cvar(c), bvstack1, depth) <= depth - top;
+    case ABST:
+      if (depth >= MAXABSTDEPTH)
+	return 0;
+      bvstack1[depth] = Cbv(c);
+      return isclosed(Cbody(c), top, depth + 1);
+    case APPL:
+      return isclosed(Cleft(c), top, depth) && isclosed(Cright(c), top, depth);
+    default:
+      fatal("isclosed: unexpected cell type %d\n", Ctype(c));
+  }
+  /*NOTREACHED*/
+  return 0;
+}
+
+/*
+ * memo of reductions for betadiff
+ *
+ * A closed subtree is reduced the same way wherever it is, so where
+ * betadiff reaches one, it looks for the subtree in the memo.  A normal
+ * form found there is copied in place of the subtree, and its #steps is
+ * counted, if the reduction would have finished within the budget;
+ * where it stopped at maxstep is used likewise if exactly that many
+ * steps are left.  Otherwise the subtree is reduced, and what it becomes
+ * is put in the memo, replacing the entry of the same slot.  The hashes
+ * taken as keys are of closed subtrees, so they do not depend on where
+ * the subtrees are.
+ */
+
+static void
+memoinit(int n) {
+  int i;
+
+  for (i = 0; i < memosize; i++)
+    if (memotab[i].result >= 0)
+      prunecell(memotab[i].result);
+  free(memotab);
+  memotab = NULL;
+  memosize = 0;
+  if (n <= 0)
+    return;
+  memotab = emalloc(n * sizeof(memotab[0]));
+  for (i = 0; i < n; i++)
+    memotab[i].result = -1;
+  memosize = n;
+}
+
+/*
+ * memosplice - replace c with its reduct in the memo if it can be used.
+ *              returns 1 if done.
+ */
+static int
+memosplice(Cellidx c) {
+  struct memo *e;
+  unsigned long h;
+  int left, outside, i;
+  Cellidx newci;
+
+  h = hashLexp(c);
+  memolookups++;
+  e = &memotab[h % memosize];
+  if (e->result < 0 || e->hash != h || e->size != Csize(c) ||
+      e->height != Cheight(c) || e->digest != Cdigest(c))
+    return 0;
+  if (bdmaxstep > 0) {
+    left = bdmaxstep - *bdsteps;
+    if (e->finished ? e->steps > left : e->steps != left)
+      return 0;
+  } else if (!e->finished)
+    return 0;
+  outside = Csize(bdroot) - Csize(c);
+  if (bdmaxcells > 0 && outside + e->peak > bdmaxcells)
+    return 0;
+  memohits++;
+
+  /* as if reduced here */
+  *bdsteps += e->steps;
+  peakcells = max(peakcells, outside + e->peak);
+  for (i = 0; i < nmemorec; i++)
+    memorec[i].key.peak = max(memorec[i].key.peak,
+	Csize(memorec[i].cell) - Csize(c) + e->peak);
+  if (!e->finished)
+    bdstopped = BD_STEPS;
+
+  /* overwrite c with a copy of the result, like betaat does */
+  newci = deepcopy(e->result);
+  switch (Ctype(c)) {
+    case ABST:
+      prunecell(Cbody(c));
+      break;
+    case APPL:
+      prunecell(Cleft(c));
+      prunecell(Cright(c));
+      break;
+  }
+  copycell(newci, c);
+  freecell(newci);
+  for (i = bdbase - 1; i >= 0; i--)
+    annotate(redexpath[i]);
+  return 1;
+}
+
+/*
+ * memostart - begin recording the reduction of c, whose hash is valid.
+ *             returns the index in memorec, -1 if too deeply nested.
+ */
+static int
+memostart(Cellidx c) {
+  struct memo *k;
+
+  if (nmemorec >= MAXMEMOREC)
+    return -1;
+  memorec[nmemorec].cell = c;
+  k = &memorec[nmemorec].key;
+  k->hash = Chash(c);
+  k->size = Csize(c);
+  k->height = Cheight(c);
+  k->digest = Cdigest(c);
+  k->steps = *bdsteps;		/* to be subtracted */
+  k->peak = Csize(c);
+  return nmemorec++;
+}
+
+/*
+ * memoend - end recording r, and enter the result in the memo if c has
+ *           been reduced as far as it goes or as maxstep lets it
+ */
+static void
+memoend(int r) {
+  struct memo *k, *e;
+  Cellidx c;
+
+  assert(r == nmemorec - 1);
+  nmemorec--;
+  c = memorec[r].cell;
+  k = &memorec[r].key;
+  k->steps = *bdsteps - k->steps;
+  if (k->steps < MEMOMINSTEPS || bdskipped || bdstopped == BD_CELLS)
+    return;
+  if (bdstopped == BD_STEPS)
+    k->finished = 0;
+  else if (bdlimit >= 0 && bddist > bdlimit)
+    return;	/* left unreduced where the limit was exceeded */
+  else
+    k->finished = 1;
+
+  e = &memotab[k->hash % memosize];
+  if (e->result >= 0)
+    prunecell(e->result);
+  *e = *k;
+  e->result = deepcopy(c);
+}
+
+/*
+ * todebruijn - put the cells of c in prefix order in types[] and idx[]
+ *              as Lfromdebruijn takes them.  bvs[] are the binding
+ *              variables of the depth enclosing lambdas.  returns the
+ *              #cells, or -1 if c has a free variable.
+ */
+static int
+todebruijn(Cellidx c, int depth, Var bvs[], unsigned char *types, Var *idx) {
+  int i, n, m;
+
+  *types = Ctype(c);
+  *idx = 0;
+  switch (Ctype(c)) {
+    case VAR:
+      for (i = depth - 1; i >= 0; i--)
+	if (bvs[i] == Cvar(c))
+	  break;
+      if (i < 0)
+	return -1;
+      *idx = depth - i;
+      return 1;
+    case ABST:
+      if (depth >= MAXABSTDEPTH)
+	return -1;
+      bvs[depth] = Cbv(c);
+      n = todebruijn(Cbody(c), depth + 1, bvs, types + 1, idx + 1);
+      return (n < 0) ? -1 : 1 + n;
+    case APPL:
+      if ((n = todebruijn(Cleft(c), depth, bvs, types + 1, idx + 1)) < 0)
+	return -1;
+      m = todebruijn(Cright(c), depth, bvs, types + 1 + n, idx + 1 + n);
+      return (m < 0) ? -1 : 1 + n + m;
+    default:
+      abortwithcore("todebruijn: unknown cell type %d, Cellidx = %ld\n", Ctype(c), c);
+      return -1;
+  }
+}
+
+/*
+ * memodump - the entries are put one after another: struct memo, with
+ *            #cells of the result in place of the result, then the
+ *            types (a byte each) and indices of the cells in prefix
+ *            order.  results with free variables are left out.
+ */
+static long
+memodump(unsigned char *buf, long cap) {
+  Var bvs[MAXABSTDEPTH];
+  unsigned char *types;
+  struct memo m;
+  long len, need;
+  int i, n;
+
+  need = 0;
+  for (i = 0; i < memosize; i++)
+    if (memotab[i].result >= 0)
+      need += sizeof(struct memo) + Csize(memotab[i].result) * (1 + sizeof(Var));
+  if (buf == NULL || cap < need)
+    return need;
+
+  len = 0;
+  for (i = 0; i < memosize; i++) {
+    if (memotab[i].result < 0)
+      continue;
+    m = memotab[i];
+    types = buf + len + sizeof(m);
+    growbuild(Csize(m.result));
+    n = todebruijn(m.result, 0, bvs, types, buildidx);
+    if (n >= 0) {
+      m.result = n;
+      memcpy(buf + len, &m, sizeof(m));
+      memcpy(types + n, buildidx, n * sizeof(Var));
+      len += sizeof(m) + n * (1 + sizeof(Var));
+    }
+  }
+  /* what is left out is zero; no entry has 0 cells */
+  memset(buf + len, 0, need - len);
+  return need;
+}
+
+static int
+memoload(const unsigned char *buf, long len) {
+  struct memo m, *e;
+  long pos;
+  int i;
+
+  if (memosize <= 0)
+    return 0;
+  pos = 0;
+  while (pos + (long)sizeof(m) <= len) {
+    memcpy(&m, buf + pos, sizeof(m));
+    pos += sizeof(m);
+    if (m.result == 0)
+      break;	/* padding */
+    if (m.result < 0 || pos + m.result * (long)(1 + sizeof(Var)) > len)
+      return -1;
+    growbuild(m.result);
+    for (i = 0; i < m.result; i++)
+      buildtypes[i] = buf[pos + i];
+    memcpy(buildidx, buf + pos + m.result, m.result * sizeof(Var));
+    pos += m.result * (1 + sizeof(Var));
+
+    e = &memotab[m.hash % memosize];
+    if (e->result >= 0)
+      prunecell(e->result);
+    *e = m;
+    e->result = fromdebruijn(m.result, buildtypes, buildidx);
+  }
+  return 0;
+}
+
+/*
+ * bdcompare - reduce c1 and add its difference from c2 to bddist
+ */
+static void
+bdcompare(Cellidx c1, Cellidx c2, int depth) {
+  int base, bound;
+
+  /* head normal form */
+  while (bdstep(c1, 1))
+    ;
+
+  if (Ctype(c1) == Ctype(c2) && Ctype(c1) != VAR) {
+    base = bdbase;
+    pathlen = bdbase;
+    pushpath(c1);
+    bdbase = pathlen;
+    if (Ctype(c1) == ABST) {
+      if (depth >= MAXABSTDEPTH) {
+	msg_warning(F_MISC, "bdcompare: MAXABSTDEPTH reached; ignoring the subtree\n");
+	bdskipped = 1;
+      } else {
+	bvstack1[depth] = Cbv(c1);
+	bvstack2[depth] = Cbv(c2);
+	betadiff_r(Cbody(c1), Cbody(c2), depth + 1);
+      }
+    } else {
+      betadiff_r(Cleft(c1), Cleft(c2), depth);
+      betadiff_r(Cright(c1), Cright(c2), depth);
+    }
+    bdbase = base;
+    return;
+  }
+
+  if (Ctype(c1) != VAR) {
+    /* different shape; the whole subtree counts */
+    if (bdlimit >= 0 && !bdstopped) {
+      bound = bdbound(c1, c2);
+      if (bddist + bound > bdlimit) {
+	bddist += bound;
+	return;
+      }
+    }
+    while (bdstep(c1, 0))
+      ;
+  }
+  bddist += diffleaf(c1, bvstack1, c2, bvstack2, depth);
+}
+
+static void
+betadiff_r(Cellidx c1, Cellidx c2, int depth) {
+  int r;
+
+  if (bdlimit >= 0 && bddist > bdlimit)
+    return;
+
+  r = -1;
+  if (memosize > 0 && !bdstopped && Cnredex(c1) > 0 && Csize(c1) >= MEMOMINCELLS &&
+      (depth == 0 || isclosed(c1, depth, depth)) && !memosplice(c1))
+    r = memostart(c1);
+  bdcompare(c1, c2, depth);
+  if (r >= 0)
+    memoend(r);
+}
+
+static int
+betadiff(Lexp l, Lexp target, int *steps, int maxstep, int maxcells, int limit) {
+  bdroot = l;
+  bdsteps = steps;
+  bdmaxstep = maxstep;
+  bdmaxcells = maxcells;
+  bdlimit = limit;
+  bddist = 0;
+  bdstopped = BD_GOING;
+  bdskipped = 0;
+  bdbase = 0;
+  nmemorec = 0;
+  peakcells = Csize(l);
+  betadiff_r(l, target, 0);
+  pathlen = 0;
+  if (deblev(L_DEBUG, F_MISC)) {
+    msg_debug(F_MISC, "betadiff: %d steps, |", *steps);
+    fprintlexp_n(stderr, l);
+    msg_debug(F_MISC, " - ");
+    fprintlexp_n(stderr, target);
+    msg_debug(F_MISC, "| = %d, memo %lu/%lu\n", bddist, memohits, memolookups);
+  }
+  return bddist;
+}
+
+/*
+ * arraynodes - add the number of nodes at each level to array a,
+ *              which the caller has cleared.  returns deepest level reached.
  */
 
 static int
@@ -1922,14 +3084,4 @@ arraynodes_r(Cellidx ci, int curlev, int a[], int asize) {
   return curlev;
 }
 
-static int
-arraynodes(Cellidx ci, int a[], int asize) {
-  int i;
-
-  for (i = 0; i < asize; i++)
-    a[i] = 0;
-
-  return arraynodes_r(ci, 0, a, asize);
-}
-
 /* [EOF] */
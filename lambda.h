@@ -8,10 +8,13 @@
 #ifndef __LAMBDA_H
 #define __LAMBDA_H
 
+#include <stdio.h>
+
 /* types */
 typedef long int Var;		/* variable */
 typedef long int Lexp;		/* lambda expression */
 typedef long int Cellidx;	/* is Lexp; necessary for dfs */
+typedef struct lstate *Lstate;	/* engine */
 
 /* constants */
 enum {
@@ -31,17 +34,32 @@ Lexp Lnewvar(Var);
 Lexp Labst(Var, Lexp);
 Lexp Lappl(Lexp, Lexp);
 Lexp Lcopy(Lexp);
+Lexp Lfromdebruijn(int, int [], Var []);
+void Lbuildbuf(int, int **, Var **);
 void Lfree(Lexp);
 Lexp Lstr2Lexp(char *);
 int LLexp2str(Lexp, char *, int);
+void Lfprint(FILE *, Lexp);
 void Lcanon(Lexp);
 int Leq(Lexp, Lexp);
+unsigned long Lhash(Lexp);
 int Lbeta(Lexp, int, int, int);
+int Lpeakcells(void);
 void Linit(void);
+Lstate Lnewstate(void);
+Lstate Luse(Lstate);
+void Lfreestate(Lstate);
 void LdfsLexp(Lexp, int (*)(Cellidx, int));
 int Ltype(Cellidx);
 int Lcountcells(Lexp);
+int Lcountappl(Lexp);
 void Lepoolinfo(void);
+int Ldiff(Lexp, Lexp);
+void Ldiffn(Lexp, Lexp [], int, int [], int []);
+int Lbetadiff(Lexp, Lexp, int *, int, int, int);
+void Lmemo(int);
+long Lmemodump(unsigned char *, long);
+int Lmemoload(const unsigned char *, long);
 
 /* lambint.c - interface with lilgp */
 Lexp Icreatebvar(Var);
@@ -6,11 +6,13 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 
 #include <lilgp.h>
 
 #include "lambda.h"
+#include "function.h"
 
 /*
  * create new Var cell for variable #vi (internal form = negative)
@@ -39,4 +41,60 @@ Icreatebvar(Var vi) {
      return newbv;
 }
 
+/*
+ * Itree2debruijn - the nodes of a GP tree in prefix order, as
+ *                  Lfromdebruijn() takes them.  types and idx must
+ *                  have room for size nodes.  returns the #nodes.
+ */
+
+int
+Itree2debruijn(lnode *data, int size, int types[], Var idx[]) {
+     int i, n;
+
+     n = 0;
+     for (i = 0; i < size; ) {
+	  switch (data[i].f->type) {
+	  case TERM_ERC:
+	       /* variable; the ERC follows */
+	       types[n] = VAR;
+	       idx[n] = -data[i+1].d->d;
+	       i += 2;
+	       break;
+	  case FUNC_EXPR:
+	       /* abstraction; a skip node follows */
+	       types[n] = ABST;
+	       idx[n] = 0;
+	       i += 2;
+	       break;
+	  default:
+	       /* application */
+	       types[n] = APPL;
+	       idx[n] = 0;
+	       i += 1;
+	       break;
+	  }
+	  n++;
+     }
+     return n;
+}
+
+/*
+ * Itree2lexp - build the lexp of a GP tree directly from its prefix
+ *              array, without evaluate_tree() and the function
+ *              callbacks.  the variables are named as Icreatebvar()
+ *              does.  the arrays are the engine's own, so nothing is
+ *              allocated per call.
+ */
+
+Lexp
+Itree2lexp(lnode *data, int size) {
+     int *types;
+     Var *idx;
+     int n;
+
+     Lbuildbuf(size, &types, &idx);
+     n = Itree2debruijn(data, size, types, idx);
+     return Lfromdebruijn(n, types, idx);
+}
+
 /* EOF */
@@ -0,0 +1,250 @@
+/*
+ * ltest.c - test of the lambda engine on random terms
+ *
+ * The faster paths of the engine must give what the plain ones do:
+ * Lbetadiff() what Lbeta() then Ldiff() give, and no more than its limit
+ * says; Ldiffn() what Ldiff() gives for each target; Leq() and Lhash()
+ * what the distance says about equality, for alpha variants too; and
+ * Lbetadiff() with the memo, also reloaded from a dump, what it gives
+ * without.  And an individual off by one on a single testcase must not
+ * pass for perfect the way gp confirms one.
+ *
+ * usage: ltest [#terms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lambda.h"
+
+#define MAXHEIGHT	8	/* of the random terms */
+#define ALTNAMES	1000	/* binding variables of the alpha variant */
+#define FREEVAR		500	/* first free variable */
+#define MAXSTEP		300
+#define MAXCELLS	4000
+#define NTARGETS	4
+#define MEMOSIZE	4096
+#define NCASES		8	/* testcases 0.. of the off-by-one individual */
+
+/* result of reducing a term and comparing it with its target */
+struct result {
+     Lexp reduct;
+     int dist;
+     int steps;
+     int peak;
+};
+
+static int nfail = 0;
+
+static void
+fail(int i, char *what)
+{
+     printf("FAIL term %d: %s\n", i, what);
+     nfail++;
+}
+
+/*
+ * term - random lexp; the binding variable at depth d is named d, or
+ *        d + ALTNAMES for the alpha variant
+ */
+static Lexp
+term(int depth, int height, int alt)
+{
+     Lexp l;
+     int r;
+
+     r = random() % 10;
+     if (height >= MAXHEIGHT || r < 3) {
+	  if (depth > 0 && random() % 4 != 0)
+	       return Lnewvar(1 + random() % depth + alt * ALTNAMES);
+	  return Lnewvar(FREEVAR + random() % 3);
+     }
+     if (r < 6)
+	  return Labst(depth + 1 + alt * ALTNAMES, term(depth + 1, height + 1, alt));
+     l = term(depth, height + 1, alt);
+     return Lappl(l, term(depth, height + 1, alt));
+}
+
+/* term i applied to a numeral, as the problem does, or to another term */
+static Lexp
+applied(int i, int alt)
+{
+     Lexp l;
+
+     srandom(i);
+     l = term(0, 0, alt);
+     if (i % 3 == 0)
+	  return Lappl(l, term(0, 1, alt));
+     return Lappl(l, Cchurch_num(i % 5));
+}
+
+/* plain reduction, then the distance */
+static void
+plain(Lexp l, Lexp target, struct result *res)
+{
+     res->reduct = Lcopy(l);
+     res->steps = Lbeta(res->reduct, CANONICAL, MAXSTEP, MAXCELLS);
+     res->peak = Lpeakcells();
+     res->dist = Ldiff(res->reduct, target);
+}
+
+/* Lbetadiff without a limit must give res */
+static void
+samebetadiff(int i, Lexp l, Lexp target, struct result *res, char *what)
+{
+     Lexp m;
+     int steps, dist;
+
+     m = Lcopy(l);
+     steps = 0;
+     dist = Lbetadiff(m, target, &steps, MAXSTEP, MAXCELLS, -1);
+     if (dist != res->dist)
+	  fail(i, what);
+     else if (steps != res->steps)
+	  fail(i, what);
+     else if (Lpeakcells() != res->peak)
+	  fail(i, what);
+     else if (!Leq(m, res->reduct))
+	  fail(i, what);
+     Lfree(m);
+}
+
+/*
+ * offbyone - an individual right on all the testcases but 0, where it
+ *            gives 1, summed as fullfitness() in app.c does.  the sum
+ *            is less than #testcases, but must not be 0.
+ */
+static void
+offbyone(void)
+{
+     Lexp f, l, target;
+     int c, d, sum, steps;
+
+     /* n (L y.(double n)) 1: (L 1.((1 (L 4.(L 2.(L 3.((1 2) ((1 2) 3)))))) (L 5.(L 6.(5 6))))) */
+     f = Labst(1, Lappl(Lappl(Lnewvar(1),
+	  Labst(4, Labst(2, Labst(3, Lappl(Lappl(Lnewvar(1), Lnewvar(2)),
+	  Lappl(Lappl(Lnewvar(1), Lnewvar(2)), Lnewvar(3))))))),
+	  Labst(5, Labst(6, Lappl(Lnewvar(5), Lnewvar(6))))));
+     sum = 0;
+     for (c = NCASES - 1; c >= 0 && sum == 0; c--) {
+	  l = Lappl(Lcopy(f), Cchurch_num(c));
+	  target = Cchurch_num(2 * c);
+	  steps = 0;
+	  d = Lbetadiff(l, target, &steps, MAXSTEP, MAXCELLS, 0);
+	  if (c > 0 && d != 0) {
+	       printf("FAIL: off-by-one individual wrong on %d\n", c);
+	       nfail++;
+	  }
+	  sum += d;
+	  Lfree(l);
+	  Lfree(target);
+     }
+     if (sum == 0) {
+	  printf("FAIL: off by one on a testcase, yet perfect\n");
+	  nfail++;
+     }
+     Lfree(f);
+}
+
+int
+main(int argc, char **argv)
+{
+     struct result *res;
+     Lexp targets[NTARGETS], a, b, l;
+     int limits[NTARGETS], dists[NTARGETS];
+     unsigned char *buf;
+     long len;
+     int n, i, k, d, steps, limit;
+
+     n = (argc > 1) ? atoi(argv[1]) : 2000;
+     if ((res = calloc(n, sizeof(res[0]))) == NULL) {
+	  fprintf(stderr, "ltest: cannot allocate for %d terms\n", n);
+	  return 2;
+     }
+     Linit();
+     for (k = 0; k < NTARGETS; k++)
+	  targets[k] = Cchurch_num(2 * k + 1);
+
+     for (i = 0; i < n; i++) {
+	  /* equality, on an alpha variant and on another term */
+	  a = applied(i, 0);
+	  b = applied(i, 1);
+	  if (!Leq(a, b) || Lhash(a) != Lhash(b) || Ldiff(a, b) != 0)
+	       fail(i, "alpha variant not equal");
+	  Lfree(b);
+	  b = applied(i + n, 0);
+	  if (Leq(a, b) != (Ldiff(a, b) == 0))
+	       fail(i, "Leq and Ldiff disagree");
+	  if (Leq(a, b) && Lhash(a) != Lhash(b))
+	       fail(i, "equal terms with different hashes");
+	  Lfree(b);
+
+	  /* Lbetadiff, without a limit and with one */
+	  plain(a, targets[i % NTARGETS], &res[i]);
+	  samebetadiff(i, a, targets[i % NTARGETS], &res[i], "Lbetadiff differs from Lbeta and Ldiff");
+	  limit = random() % (res[i].dist + 3);
+	  l = Lcopy(a);
+	  steps = 0;
+	  d = Lbetadiff(l, targets[i % NTARGETS], &steps, MAXSTEP, MAXCELLS, limit);
+	  if (res[i].dist <= limit ? d != res[i].dist : d <= limit)
+	       fail(i, "Lbetadiff breaks its limit");
+	  Lfree(l);
+
+	  /* Ldiffn, without limits and with them */
+	  for (k = 0; k < NTARGETS; k++)
+	       limits[k] = -1;
+	  Ldiffn(res[i].reduct, targets, NTARGETS, limits, dists);
+	  for (k = 0; k < NTARGETS; k++)
+	       if (dists[k] != Ldiff(res[i].reduct, targets[k]))
+		    fail(i, "Ldiffn differs from Ldiff");
+	  for (k = 0; k < NTARGETS; k++)
+	       limits[k] = random() % 20;
+	  Ldiffn(res[i].reduct, targets, NTARGETS, limits, dists);
+	  for (k = 0; k < NTARGETS; k++) {
+	       d = Ldiff(res[i].reduct, targets[k]);
+	       if (d <= limits[k] ? dists[k] != d : dists[k] <= limits[k])
+		    fail(i, "Ldiffn breaks its limit");
+	  }
+	  Lfree(a);
+     }
+
+     /* the memo, filled by the first pass, used by the second */
+     Lmemo(MEMOSIZE);
+     for (k = 0; k < 2; k++)
+	  for (i = 0; i < n; i++) {
+	       a = applied(i, 0);
+	       samebetadiff(i, a, targets[i % NTARGETS], &res[i], "memo changes Lbetadiff");
+	       Lfree(a);
+	  }
+     if ((len = Lmemodump(NULL, 0)) <= 0) {
+	  printf("FAIL: nothing memoized\n");
+	  nfail++;
+     }
+
+     /* and reloaded from a dump */
+     if ((buf = malloc(len)) == NULL || Lmemodump(buf, len) != len) {
+	  fprintf(stderr, "ltest: cannot dump the memo\n");
+	  return 2;
+     }
+     Lmemo(0);
+     Lmemo(MEMOSIZE);
+     if (Lmemoload(buf, len) < 0) {
+	  printf("FAIL: memo not reloaded\n");
+	  nfail++;
+     }
+     for (i = 0; i < n; i++) {
+	  a = applied(i, 0);
+	  samebetadiff(i, a, targets[i % NTARGETS], &res[i], "reloaded memo changes Lbetadiff");
+	  Lfree(a);
+     }
+     free(buf);
+     Lmemo(0);
+
+     offbyone();
+
+     if (nfail == 0)
+	  printf("ltest: OK\n");
+     return nfail != 0;
+}
+
+/* [EOF] */
@@ -0,0 +1,388 @@
+/*
+ * lz.c - LZ77 block compression and framed streams of blocks
+ *
+ * The block format is that of LZ4: a sequence is a token byte (4 bits
+ * of literal length, 4 bits of match length - 4; 15 = more bytes of
+ * length follow, each added until one is not 255), the literals, and
+ * the 2-byte little-endian offset of the match followed by the rest of
+ * its length.  The last sequence has literals only.  The compressor is
+ * the greedy one with a single hash table of 4-byte prefixes; it is
+ * fast rather than thorough.
+ *
+ * A stream is a sequence of frames, each a struct zframe followed by
+ * one block of at most ZFRAMESIZE bytes of raw data, compressed or not
+ * (zlen == rawlen when compression did not pay).  A frame is written
+ * only by Zflush(), so a stream read after a crash has all the data
+ * up to the last flush.  A stream written with compression off has no
+ * frames at all; Zopenread() tells which and reads both.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz.h"
+
+enum {
+     ZFRAMESIZE = 1 << 20,	/* max raw bytes in a frame */
+     ZHASHBITS = 13,
+     ZMINMATCH = 4,
+     ZMAXOFFSET = 65535,
+};
+
+#define ZMAGIC	0x7a70676cU	/* "lgpz" */
+
+struct zframe {
+     unsigned int magic;
+     int rawlen;
+     int zlen;		/* #bytes that follow */
+     unsigned int check;	/* of the raw data */
+};
+
+static unsigned int
+zcheck(const unsigned char *p, int n)
+{
+     unsigned int h = 2166136261U;
+
+     while (n-- > 0)
+	  h = (h ^ *p++) * 16777619U;
+     return h;
+}
+
+static unsigned int
+zhash(const unsigned char *p)
+{
+     unsigned int v;
+
+     v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+     return (v * 2654435761U) >> (32 - ZHASHBITS);
+}
+
+static unsigned char *
+putlen(unsigned char *op, int len)
+{
+     while (len >= 255) {
+	  *op++ = 255;
+	  len -= 255;
+     }
+     *op++ = len;
+     return op;
+}
+
+/*
+ * Zbound - max compressed size of n bytes
+ */
+int
+Zbound(int n)
+{
+     return n + n / 255 + 16;
+}
+
+/*
+ * Zcompress - compress n bytes of src into dst of cap bytes.
+ *             returns the compressed size, or -1 if cap < Zbound(n).
+ */
+int
+Zcompress(const unsigned char *src, int n, unsigned char *dst, int cap)
+{
+     int table[1 << ZHASHBITS];	/* position + 1 of a prefix; 0 = none */
+     const unsigned char *ip, *end, *anchor, *ref;
+     unsigned char *op, *token;
+     unsigned int h;
+     int litlen, mlen, prev;
+
+     if (cap < Zbound(n))
+	  return -1;
+     memset(table, 0, sizeof(table));
+     ip = anchor = src;
+     end = src + n;
+     op = dst;
+     while (end - ip >= ZMINMATCH) {
+	  h = zhash(ip);
+	  prev = table[h];
+	  table[h] = ip - src + 1;
+	  ref = src + prev - 1;
+	  if (prev == 0 || ip - ref > ZMAXOFFSET || memcmp(ref, ip, ZMINMATCH) != 0) {
+	       ip++;
+	       continue;
+	  }
+	  for (mlen = ZMINMATCH; ip + mlen < end && ref[mlen] == ip[mlen]; mlen++)
+	       ;
+
+	  /* literals, then the match */
+	  token = op++;
+	  litlen = ip - anchor;
+	  if (litlen >= 15) {
+	       *token = 15 << 4;
+	       op = putlen(op, litlen - 15);
+	  } else
+	       *token = litlen << 4;
+	  memcpy(op, anchor, litlen);
+	  op += litlen;
+	  *op++ = (ip - ref) & 0xff;
+	  *op++ = (ip - ref) >> 8;
+	  if (mlen - ZMINMATCH >= 15) {
+	       *token |= 15;
+	       op = putlen(op, mlen - ZMINMATCH - 15);
+	  } else
+	       *token |= mlen - ZMINMATCH;
+	  ip += mlen;
+	  anchor = ip;
+     }
+
+     /* last literals */
+     token = op++;
+     litlen = end - anchor;
+     if (litlen >= 15) {
+	  *token = 15 << 4;
+	  op = putlen(op, litlen - 15);
+     } else
+	  *token = litlen << 4;
+     memcpy(op, anchor, litlen);
+     op += litlen;
+     return op - dst;
+}
+
+/*
+ * Zdecompress - decompress n bytes of src into dst of cap bytes.
+ *               returns the decompressed size, or -1 if src is broken
+ *               or does not fit.
+ */
+int
+Zdecompress(const unsigned char *src, int n, unsigned char *dst, int cap)
+{
+     const unsigned char *ip, *iend;
+     unsigned char *op, *ref;
+     int token, len, b, off;
+
+     ip = src;
+     iend = src + n;
+     op = dst;
+     while (ip < iend) {
+	  token = *ip++;
+	  len = token >> 4;
+	  if (len == 15)
+	       do {
+		    if (ip >= iend)
+			 return -1;
+		    b = *ip++;
+		    len += b;
+	       } while (b == 255);
+	  if (len > iend - ip || len > dst + cap - op)
+	       return -1;
+	  memcpy(op, ip, len);
+	  op += len;
+	  ip += len;
+	  if (ip == iend)
+	       break;	/* last sequence */
+
+	  if (iend - ip < 2)
+	       return -1;
+	  off = ip[0] | (ip[1] << 8);
+	  ip += 2;
+	  if (off == 0 || off > op - dst)
+	       return -1;
+	  len = token & 15;
+	  if (len == 15)
+	       do {
+		    if (ip >= iend)
+			 return -1;
+		    b = *ip++;
+		    len += b;
+	       } while (b == 255);
+	  len += ZMINMATCH;
+	  if (len > dst + cap - op)
+	       return -1;
+	  /* may overlap; byte by byte */
+	  for (ref = op - off; len > 0; len--)
+	       *op++ = *ref++;
+     }
+     return op - dst;
+}
+
+/*
+ * Zopenwrite - start writing a stream to fp, in frames if compress
+ */
+void
+Zopenwrite(struct zstream *z, FILE *fp, int compress)
+{
+     memset(z, 0, sizeof(*z));
+     z->fp = fp;
+     z->writing = 1;
+     z->compress = compress;
+}
+
+/*
+ * Zwrite - write n bytes to the stream.  returns 0 if OK, -1 if not.
+ */
+int
+Zwrite(struct zstream *z, const void *p, int n)
+{
+     const unsigned char *s = p;
+     int k;
+
+     if (z->fp == NULL || !z->writing)
+	  return -1;
+     if (!z->compress)
+	  return fwrite(p, 1, n, z->fp) == (size_t)n ? 0 : -1;
+
+     if (z->buf == NULL) {
+	  if ((z->buf = malloc(ZFRAMESIZE)) == NULL)
+	       return -1;
+	  z->cap = ZFRAMESIZE;
+     }
+     while (n > 0) {
+	  k = z->cap - z->len;
+	  if (k > n)
+	       k = n;
+	  memcpy(z->buf + z->len, s, k);
+	  z->len += k;
+	  s += k;
+	  n -= k;
+	  if (z->len == z->cap && Zflush(z) < 0)
+	       return -1;
+     }
+     return 0;
+}
+
+/*
+ * Zflush - write out what has been written to the stream, as a frame
+ *          if in frames.  returns 0 if OK, -1 if not.
+ */
+int
+Zflush(struct zstream *z)
+{
+     struct zframe h;
+     const unsigned char *data;
+
+     if (z->fp == NULL || !z->writing)
+	  return -1;
+     if (z->compress && z->len > 0) {
+	  if (z->zbuf == NULL) {
+	       z->zcap = Zbound(ZFRAMESIZE);
+	       if ((z->zbuf = malloc(z->zcap)) == NULL)
+		    return -1;
+	  }
+	  h.magic = ZMAGIC;
+	  h.rawlen = z->len;
+	  h.zlen = Zcompress(z->buf, z->len, z->zbuf, z->zcap);
+	  h.check = zcheck(z->buf, z->len);
+	  data = z->zbuf;
+	  if (h.zlen < 0 || h.zlen >= h.rawlen) {
+	       h.zlen = h.rawlen;	/* stored */
+	       data = z->buf;
+	  }
+	  if (fwrite(&h, sizeof(h), 1, z->fp) != 1 ||
+	      fwrite(data, 1, h.zlen, z->fp) != (size_t)h.zlen)
+	       return -1;
+	  z->len = 0;
+     }
+     return fflush(z->fp) == 0 ? 0 : -1;
+}
+
+/*
+ * Zclose - flush (if writing) and free the stream; fp is left open
+ */
+void
+Zclose(struct zstream *z)
+{
+     if (z->fp != NULL && z->writing)
+	  Zflush(z);
+     free(z->buf);
+     free(z->zbuf);
+     memset(z, 0, sizeof(*z));
+}
+
+/*
+ * readframe - read the frame after header h into z->buf.
+ *             returns 0 if OK, -1 if not.
+ */
+static int
+readframe(struct zstream *z, struct zframe *h)
+{
+     unsigned char *p;
+
+     if (h->magic != ZMAGIC || h->rawlen < 0 || h->rawlen > ZFRAMESIZE ||
+	 h->zlen < 0 || h->zlen > h->rawlen)
+	  return -1;
+     if (z->buf == NULL) {
+	  z->cap = ZFRAMESIZE;
+	  z->zcap = ZFRAMESIZE;
+	  if ((z->buf = malloc(z->cap)) == NULL || (z->zbuf = malloc(z->zcap)) == NULL)
+	       return -1;
+     }
+     p = (h->zlen == h->rawlen) ? z->buf : z->zbuf;
+     if (fread(p, 1, h->zlen, z->fp) != (size_t)h->zlen)
+	  return -1;
+     if (p == z->zbuf && Zdecompress(z->zbuf, h->zlen, z->buf, z->cap) != h->rawlen)
+	  return -1;
+     if (zcheck(z->buf, h->rawlen) != h->check)
+	  return -1;
+     z->len = h->rawlen;
+     z->pos = 0;
+     return 0;
+}
+
+/*
+ * Zopenread - start reading a stream from fp, in frames or not
+ */
+void
+Zopenread(struct zstream *z, FILE *fp)
+{
+     struct zframe h;
+     size_t n;
+
+     memset(z, 0, sizeof(*z));
+     z->fp = fp;
+     n = fread(&h, 1, sizeof(h), fp);
+     if (n == sizeof(h) && h.magic == ZMAGIC) {
+	  z->compress = 1;
+	  if (readframe(z, &h) < 0)
+	       z->len = z->pos = 0;
+	  return;
+     }
+
+     /* no frames; give back what was read */
+     if ((z->buf = malloc(sizeof(h))) == NULL)
+	  return;
+     memcpy(z->buf, &h, n);
+     z->len = n;
+     z->cap = sizeof(h);
+}
+
+/*
+ * Zread - read up to n bytes from the stream.  returns #bytes read;
+ *         less than n at the end or at a broken frame.
+ */
+int
+Zread(struct zstream *z, void *p, int n)
+{
+     unsigned char *d = p;
+     struct zframe h;
+     int k, got;
+
+     got = 0;
+     while (got < n) {
+	  if (z->pos < z->len) {
+	       k = z->len - z->pos;
+	       if (k > n - got)
+		    k = n - got;
+	       memcpy(d + got, z->buf + z->pos, k);
+	       z->pos += k;
+	       got += k;
+	       continue;
+	  }
+	  if (!z->compress)
+	       return got + fread(d + got, 1, n - got, z->fp);
+	  if (fread(&h, sizeof(h), 1, z->fp) != 1)
+	       break;
+	  if (readframe(z, &h) < 0) {
+	       fprintf(stderr, "Zread: broken frame\n");
+	       z->len = z->pos = 0;
+	       break;
+	  }
+     }
+     return got;
+}
+
+/* [EOF] */
@@ -0,0 +1,36 @@
+/*
+ * lz.h - LZ77 block compression and framed streams of blocks
+ *
+ */
+
+#ifndef _LZ_H
+#define _LZ_H
+
+#include <stdio.h>
+
+/* a stream, for writing or for reading */
+struct zstream {
+     FILE *fp;
+     int writing;
+     int compress;		/* writing: in frames; reading: frames found */
+     unsigned char *buf;	/* raw data */
+     int len, pos, cap;
+     unsigned char *zbuf;	/* compressed data */
+     int zcap;
+};
+
+int Zbound(int);
+int Zcompress(const unsigned char *, int, unsigned char *, int);
+int Zdecompress(const unsigned char *, int, unsigned char *, int);
+
+void Zopenwrite(struct zstream *, FILE *, int);
+int Zwrite(struct zstream *, const void *, int);
+int Zflush(struct zstream *);
+void Zclose(struct zstream *);
+
+void Zopenread(struct zstream *, FILE *);
+int Zread(struct zstream *, void *, int);
+
+#endif /* _LZ_H */
+
+/* [EOF] */
@@ -0,0 +1,504 @@
+/*
+ * workers.c - pool of worker processes sharing memory with gp
+ *
+ * Wstart() forks the workers, which then wait for batches of jobs.  A
+ * job is an input put in the shared arena through Wadd(); the batch
+ * also has parameters common to its jobs (Wbegin()).  Wrun() lets the
+ * workers take the jobs one at a time and waits until all are done; a
+ * worker writes the output of a job in its slot of the shared results
+ * array.  Being forked from gp after its initialization, a worker has
+ * everything gp had then, in memory of its own; nothing it does later
+ * is seen by gp or the other workers but the outputs.  A worker that
+ * crashes takes down only the job it was on: Wrun() finds it dead,
+ * marks that job W_CRASHED and forks a new worker in its place.
+ *
+ * Each worker is woken by a byte on a pipe of its own and tells that
+ * it has found no more jobs by two bytes (its number and that of the
+ * batch) on a pipe shared by all.  A wake byte left by a worker that
+ * died is taken out before a new one starts in its place, and a done
+ * message of an earlier batch is dropped.
+ *
+ * Jobs differ in cost by orders of magnitude, and a batch takes as
+ * long as its slowest worker.  Wrun() deals the jobs, most expensive
+ * first by the estimates given to Wadd(), each to the worker with the
+ * least estimated load so far, into a deque per worker.  A worker
+ * takes jobs from the head of its own deque, expensive ones first;
+ * one with an empty deque steals from the tail of the fullest one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "workers.h"
+
+enum {
+     WMAXWORKERS = 256,	/* a worker tells its number in a byte */
+     WPOLLMS = 100,	/* how often Wrun() looks for dead workers */
+};
+
+/* rounded up for any data */
+#define WALIGN(n)	(((n) + 15) & ~15L)
+
+struct wshared {
+     int njobs;
+     int quit;
+     int batch;		/* number, for the done messages */
+};
+
+struct wjob {
+     long off;		/* of the input in the arena */
+     int len;
+     int state;		/* W_PENDING, ... */
+     int worker;	/* that took it */
+     double cost;	/* estimate */
+};
+
+/* jobs dealt to a worker, wslots[head] to wslots[tail-1] */
+struct wdeque {
+     int lock;		/* 1 + the worker holding it; 0 = free */
+     int head, tail;
+     int *wslots;
+};
+
+struct worker {
+     pid_t pid;		/* 0 = none */
+     int go;		/* write end of its pipe */
+     int gor;		/* read end, for the worker */
+     int active;	/* working on this batch */
+};
+
+static struct wshared *wsh;
+static struct wjob *wjobs;
+static struct wdeque *wdeques;	/* one per worker, shared */
+static int *wslotarea;		/* nworkers * wmaxjobs, shared */
+static unsigned char *wparams, *wouts, *warena;
+static void *wmap;
+static size_t wmaplen;
+static int wmaxjobs, woutsize;
+static long warenasize, warenaused;
+static Wfunc wfunc;
+
+static struct worker *workers;
+static int nworkers;
+static int donefd[2] = { -1, -1 };
+
+static void
+wlock(struct wdeque *d, int k)
+{
+     while (!__sync_bool_compare_and_swap(&d->lock, 0, k + 1))
+	  sched_yield();
+}
+
+static void
+wunlock(struct wdeque *d)
+{
+     __sync_lock_release(&d->lock);
+}
+
+/*
+ * wtake - next job for worker k, from its own deque or stolen.
+ *         returns -1 if none is left anywhere.
+ */
+static int
+wtake(int k)
+{
+     struct wdeque *d;
+     int i, n, v, most;
+
+     d = &wdeques[k];
+     n = -1;
+     wlock(d, k);
+     if (d->head < d->tail)
+	  n = d->wslots[d->head++];
+     wunlock(d);
+
+     while (n < 0) {
+	  /* the fullest, by a look without the locks */
+	  v = -1;
+	  most = 0;
+	  for (i = 0; i < nworkers; i++)
+	       if (wdeques[i].tail - wdeques[i].head > most) {
+		    most = wdeques[i].tail - wdeques[i].head;
+		    v = i;
+	       }
+	  if (v < 0)
+	       return -1;
+	  d = &wdeques[v];
+	  wlock(d, k);
+	  if (d->head < d->tail)
+	       n = d->wslots[--d->tail];
+	  wunlock(d);
+     }
+     return n;
+}
+
+/*
+ * wloop - the life of worker k; it starts on the current batch if
+ *         working
+ */
+static void
+wloop(int k, int working)
+{
+     struct wjob *j;
+     unsigned char c, msg[2];
+     int i, n;
+
+     /* only the pipes of its own, so that it sees gp go away */
+     for (i = 0; i < nworkers; i++) {
+	  close(workers[i].go);
+	  if (i != k)
+	       close(workers[i].gor);
+     }
+     close(donefd[0]);
+
+     for (;;) {
+	  if (!working) {
+	       if (read(workers[k].gor, &c, 1) != 1 || wsh->quit)
+		    _exit(0);
+	  }
+	  working = 0;
+	  msg[1] = wsh->batch;	/* before the jobs, not to claim a later batch */
+	  while ((n = wtake(k)) >= 0) {
+	       j = &wjobs[n];
+	       j->worker = k;
+	       j->state = W_TAKEN;
+	       wfunc(wparams, warena + j->off, j->len, wouts + (long)n * woutsize);
+	       __sync_synchronize();
+	       j->state = W_DONE;
+	  }
+	  msg[0] = k;
+	  if (write(donefd[1], msg, 2) != 2)
+	       _exit(1);
+     }
+}
+
+/*
+ * wspawn - fork worker k.  returns 0 if OK, -1 if not.
+ */
+static int
+wspawn(int k, int working)
+{
+     pid_t pid;
+
+     fflush(NULL);	/* not to be written twice */
+     if ((pid = fork()) < 0) {
+	  perror("workers: fork");
+	  return -1;
+     }
+     if (pid == 0)
+	  wloop(k, working);
+     workers[k].pid = pid;
+     return 0;
+}
+
+/*
+ * Wstart - fork n workers for up to maxjobs jobs a batch, with inputs
+ *          of up to arenasize bytes in all, paramsize bytes of
+ *          parameters and outsize bytes of output each; func does a
+ *          job.  returns 0 if OK, -1 if not.
+ */
+int
+Wstart(int n, int maxjobs, long arenasize, int paramsize, int outsize, Wfunc func)
+{
+     unsigned char *p;
+     int k, fd[2];
+
+     if (n <= 0 || n > WMAXWORKERS || maxjobs <= 0) {
+	  fprintf(stderr, "workers: 1 to %d workers, please\n", WMAXWORKERS);
+	  return -1;
+     }
+     wmaxjobs = maxjobs;
+     woutsize = WALIGN(outsize);
+     warenasize = WALIGN(arenasize);
+     wfunc = func;
+
+     /* shared; the arena gets pages only as it is used */
+     wmaplen = WALIGN(sizeof(struct wshared)) + WALIGN(paramsize) +
+	  WALIGN((long)maxjobs * sizeof(struct wjob)) +
+	  WALIGN(n * sizeof(struct wdeque)) + WALIGN((long)n * maxjobs * sizeof(int)) +
+	  (long)maxjobs * woutsize + warenasize;
+     wmap = mmap(NULL, wmaplen, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+     if (wmap == MAP_FAILED) {
+	  perror("workers: mmap");
+	  wmap = NULL;
+	  return -1;
+     }
+     p = wmap;
+     wsh = (struct wshared *)p;
+     p += WALIGN(sizeof(struct wshared));
+     wparams = p;
+     p += WALIGN(paramsize);
+     wjobs = (struct wjob *)p;
+     p += WALIGN((long)maxjobs * sizeof(struct wjob));
+     wdeques = (struct wdeque *)p;
+     p += WALIGN(n * sizeof(struct wdeque));
+     wslotarea = (int *)p;
+     p += WALIGN((long)n * maxjobs * sizeof(int));
+     wouts = p;
+     p += (long)maxjobs * woutsize;
+     warena = p;
+
+     if ((workers = calloc(n, sizeof(workers[0]))) == NULL || pipe(donefd) < 0) {
+	  fprintf(stderr, "workers: cannot set up %d workers\n", n);
+	  Wstop();
+	  return -1;
+     }
+     for (k = 0; k < n; k++) {
+	  if (pipe(fd) < 0) {
+	       perror("workers: pipe");
+	       Wstop();
+	       return -1;
+	  }
+	  workers[k].gor = fd[0];
+	  workers[k].go = fd[1];
+	  nworkers++;
+     }
+     for (k = 0; k < n; k++)
+	  if (wspawn(k, 0) < 0) {
+	       Wstop();
+	       return -1;
+	  }
+     return 0;
+}
+
+/*
+ * Wstop - let the workers go and free everything
+ */
+void
+Wstop(void)
+{
+     int k;
+
+     if (wsh != NULL)
+	  wsh->quit = 1;
+     for (k = 0; k < nworkers; k++) {
+	  close(workers[k].go);		/* they see EOF */
+	  close(workers[k].gor);
+     }
+     for (k = 0; k < nworkers; k++)
+	  if (workers[k].pid != 0)
+	       waitpid(workers[k].pid, NULL, 0);
+     if (donefd[0] >= 0) {
+	  close(donefd[0]);
+	  close(donefd[1]);
+	  donefd[0] = donefd[1] = -1;
+     }
+     free(workers);
+     workers = NULL;
+     nworkers = 0;
+     if (wmap != NULL)
+	  munmap(wmap, wmaplen);
+     wmap = NULL;
+     wsh = NULL;
+}
+
+/*
+ * Wbegin - start a new batch.  returns where to put the parameters,
+ *          or NULL if there are no workers.
+ */
+void *
+Wbegin(void)
+{
+     if (wsh == NULL)
+	  return NULL;
+     wsh->njobs = 0;
+     warenaused = 0;
+     return wparams;
+}
+
+/*
+ * Wadd - add a job with an input of len bytes and an estimated cost
+ *        to the batch, and let *in point to where to put it.  returns
+ *        the job number, or -1 if the batch is full.
+ */
+int
+Wadd(int len, double cost, void **in)
+{
+     struct wjob *j;
+
+     if (wsh == NULL || wsh->njobs >= wmaxjobs || warenaused + WALIGN(len) > warenasize)
+	  return -1;
+     j = &wjobs[wsh->njobs];
+     j->off = warenaused;
+     j->len = len;
+     j->state = W_PENDING;
+     j->worker = -1;
+     j->cost = cost;
+     warenaused += WALIGN(len);
+     *in = warena + j->off;
+     return wsh->njobs++;
+}
+
+/*
+ * wdrain - take out whatever there is to read from fd, without waiting
+ */
+static void
+wdrain(int fd)
+{
+     struct pollfd pfd;
+     unsigned char buf[64];
+
+     pfd.fd = fd;
+     pfd.events = POLLIN;
+     while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) &&
+	    read(fd, buf, sizeof(buf)) > 0)
+	  ;
+}
+
+/*
+ * wreap - look after worker k, found dead with status
+ */
+static void
+wreap(int k, int status, int *respawns)
+{
+     int i;
+
+     if (WIFSIGNALED(status))
+	  fprintf(stderr, "workers: worker %d (pid %d) killed by signal %d\n",
+		  k, (int)workers[k].pid, WTERMSIG(status));
+     else
+	  fprintf(stderr, "workers: worker %d (pid %d) exited with %d\n",
+		  k, (int)workers[k].pid, WEXITSTATUS(status));
+     workers[k].pid = 0;
+     for (i = 0; i < wsh->njobs; i++)
+	  if (wjobs[i].state == W_TAKEN && wjobs[i].worker == k)
+	       wjobs[i].state = W_CRASHED;
+     /* its deque is left to the others */
+     for (i = 0; i < nworkers; i++)
+	  __sync_bool_compare_and_swap(&wdeques[i].lock, k + 1, 0);
+
+     /* a wake byte it did not read would start the new one once more */
+     wdrain(workers[k].gor);
+
+     /* a new one in its place, unless they keep dying for nothing */
+     if (--*respawns < 0 || wspawn(k, workers[k].active) < 0)
+	  workers[k].active = 0;
+}
+
+static int
+orderofcost(const void *x, const void *y)
+{
+     double a = wjobs[*(const int *)x].cost, b = wjobs[*(const int *)y].cost;
+
+     return (a < b) - (a > b);
+}
+
+/*
+ * wdeal - deal the jobs to the deques of the live workers, longest
+ *         first to the least loaded.  returns -1 if none is alive.
+ */
+static int
+wdeal(void)
+{
+     int *order;
+     double *load;
+     int i, k, least, live;
+
+     live = 0;
+     for (k = 0; k < nworkers; k++) {
+	  wdeques[k].lock = 0;
+	  wdeques[k].head = wdeques[k].tail = 0;
+	  wdeques[k].wslots = wslotarea + (long)k * wmaxjobs;
+	  live += (workers[k].pid != 0);
+     }
+     if (live == 0)
+	  return -1;
+     order = malloc(wsh->njobs * sizeof(int) + 1);
+     load = calloc(nworkers, sizeof(double));
+     if (order == NULL || load == NULL) {
+	  free(order);
+	  free(load);
+	  return -1;
+     }
+     for (i = 0; i < wsh->njobs; i++)
+	  order[i] = i;
+     qsort(order, wsh->njobs, sizeof(int), orderofcost);
+
+     for (i = 0; i < wsh->njobs; i++) {
+	  least = -1;
+	  for (k = 0; k < nworkers; k++)
+	       if (workers[k].pid != 0 && (least < 0 || load[k] < load[least]))
+		    least = k;
+	  wdeques[least].wslots[wdeques[least].tail++] = order[i];
+	  load[least] += wjobs[order[i]].cost;
+     }
+     free(order);
+     free(load);
+     return 0;
+}
+
+/*
+ * Wrun - let the workers do the jobs of the batch and wait for them.
+ *        jobs that no worker could take stay W_PENDING.  returns the
+ *        #jobs done.
+ */
+int
+Wrun(void)
+{
+     struct pollfd pfd;
+     unsigned char buf[2 * WMAXWORKERS];
+     int i, k, n, nactive, status, respawns;
+
+     if (wsh == NULL)
+	  return 0;
+     respawns = wsh->njobs + nworkers;
+
+     /* those that died while idle first, not to deal to them */
+     for (k = 0; k < nworkers; k++) {
+	  workers[k].active = 0;
+	  if (workers[k].pid != 0 && waitpid(workers[k].pid, &status, WNOHANG) == workers[k].pid)
+	       wreap(k, status, &respawns);
+     }
+     if (wdeal() < 0)
+	  return 0;
+     wsh->batch++;
+     __sync_synchronize();
+     for (k = 0; k < nworkers; k++)
+	  if (workers[k].pid != 0 && write(workers[k].go, "", 1) == 1)
+	       workers[k].active = 1;
+
+     for (;;) {
+	  for (nactive = k = 0; k < nworkers; k++)
+	       nactive += workers[k].active;
+	  if (nactive == 0)
+	       break;
+	  pfd.fd = donefd[0];
+	  pfd.events = POLLIN;
+	  /* messages are written whole, so read whole */
+	  if (poll(&pfd, 1, WPOLLMS) > 0 && (n = read(donefd[0], buf, sizeof(buf))) > 0)
+	       for (i = 0; i + 1 < n; i += 2)
+		    if (buf[i] < nworkers && buf[i+1] == (unsigned char)wsh->batch)
+			 workers[buf[i]].active = 0;
+	  for (k = 0; k < nworkers; k++)
+	       if (workers[k].pid != 0 && waitpid(workers[k].pid, &status, WNOHANG) == workers[k].pid)
+		    wreap(k, status, &respawns);
+     }
+
+     __sync_synchronize();
+     for (n = i = 0; i < wsh->njobs; i++)
+	  n += (wjobs[i].state == W_DONE);
+     return n;
+}
+
+/*
+ * Wresult - state of job j of the last batch; *out points to its
+ *           output if W_DONE
+ */
+int
+Wresult(int j, void **out)
+{
+     if (wsh == NULL || j < 0 || j >= wsh->njobs)
+	  return W_PENDING;
+     *out = wouts + (long)j * woutsize;
+     return wjobs[j].state;
+}
+
+/* [EOF] */
@@ -0,0 +1,29 @@
+/*
+ * workers.h - pool of worker processes sharing memory with gp
+ *
+ */
+
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+/* state of a job */
+enum {
+     W_PENDING = 0,	/* not taken; left to the caller */
+     W_TAKEN,		/* being worked on */
+     W_DONE,
+     W_CRASHED,		/* the worker died on it */
+};
+
+/* does a job: params of the batch, input of len bytes, output */
+typedef void (*Wfunc)(const void *, const void *, int, void *);
+
+int Wstart(int, int, long, int, int, Wfunc);
+void Wstop(void);
+void *Wbegin(void);
+int Wadd(int, double, void **);
+int Wrun(void);
+int Wresult(int, void **);
+
+#endif /* _WORKERS_H */
+
+/* [EOF] */